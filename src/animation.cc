@@ -1,8 +1,7 @@
 #include "animation.hh"
 
 animation::animation()
-:   loop_time(0), position_interpolation(LINEAR),
-    scaling_interpolation(LINEAR), orientation_interpolation(LINEAR)
+:   loop_time(0)
 {
 }
 
@@ -10,8 +9,7 @@ void animation::set_position(
     interpolation position_interpolation,
     std::vector<sample<vec3>>&& position
 ){
-    this->position_interpolation = position_interpolation;
-    this->position = std::move(position);
+    this->position.assign(position_interpolation, position);
     determine_loop_time();
 }
 
@@ -19,8 +17,7 @@ void animation::set_scaling(
     interpolation scaling_interpolation,
     std::vector<sample<vec3>>&& scaling
 ){
-    this->scaling_interpolation = scaling_interpolation;
-    this->scaling = std::move(scaling);
+    this->scaling.assign(scaling_interpolation, scaling);
     determine_loop_time();
 }
 
@@ -28,8 +25,7 @@ void animation::set_orientation(
     interpolation orientation_interpolation,
     std::vector<sample<quat>>&& orientation
 ){
-    this->orientation_interpolation = orientation_interpolation;
-    this->orientation = std::move(orientation);
+    this->orientation.assign(orientation_interpolation, orientation);
     determine_loop_time();
 }
 
@@ -37,12 +33,9 @@ void animation::set_transform(
     interpolation interp,
     const std::vector<sample<mat4>>& transform
 ){
-    this->position_interpolation = interp;
-    this->position.resize(transform.size());
-    this->scaling_interpolation = interp;
-    this->scaling.resize(transform.size());
-    this->orientation_interpolation = interp;
-    this->orientation.resize(transform.size());
+    std::vector<sample<vec3>> position(transform.size());
+    std::vector<sample<vec3>> scaling(transform.size());
+    std::vector<sample<quat>> orientation(transform.size());
     for(size_t i = 0; i < transform.size(); ++i)
     {
         const sample<mat4>& t = transform[i];
@@ -62,22 +55,37 @@ void animation::set_transform(
             );
         }
     }
+    this->position.assign(interp, position);
+    this->scaling.assign(interp, scaling);
+    this->orientation.assign(interp, orientation);
     determine_loop_time();
 }
 
 void animation::apply(transformable& node, time_ticks time) const
 {
-    if(position.size())
-        node.set_position(interpolate(time, position, position_interpolation));
-    if(scaling.size())
-        node.set_scaling(interpolate(time, scaling, scaling_interpolation));
-    if(orientation.size())
+    cursor c;
+    apply(node, time, c);
+}
+
+void animation::apply(transformable& node, time_ticks time, cursor& c) const
+{
+    if(
+        position.values.empty() && scaling.values.empty() &&
+        orientation.values.empty()
+    ) return;
+
+    vec3 p = position.values.size() ?
+        position.interpolate(time, c.position) : node.get_position();
+    vec3 s = scaling.values.size() ?
+        scaling.interpolate(time, c.scaling) : node.get_scaling();
+    quat o = node.get_orientation();
+    if(orientation.values.size())
     {
-        quat o = interpolate(time, orientation, orientation_interpolation);
-        if(orientation_interpolation == CUBICSPLINE)
+        o = orientation.interpolate(time, c.orientation);
+        if(orientation.interp == CUBICSPLINE)
             o = normalize(o);
-        node.set_orientation(o);
     }
+    node.set_transform(p, o, s);
 }
 
 time_ticks animation::get_loop_time() const
@@ -88,12 +96,12 @@ time_ticks animation::get_loop_time() const
 void animation::determine_loop_time()
 {
     loop_time = 0;
-    if(position.size())
-        loop_time = std::max(position.back().timestamp, loop_time);
-    if(scaling.size())
-        loop_time = std::max(scaling.back().timestamp, loop_time);
-    if(orientation.size())
-        loop_time = std::max(orientation.back().timestamp, loop_time);
+    if(position.timestamps.size())
+        loop_time = std::max(position.timestamps.back(), loop_time);
+    if(scaling.timestamps.size())
+        loop_time = std::max(scaling.timestamps.back(), loop_time);
+    if(orientation.timestamps.size())
+        loop_time = std::max(orientation.timestamps.back(), loop_time);
 }
 
 animated::animated(const animation_pool* pool)
@@ -110,6 +118,7 @@ time_ticks animated::set_animation(const std::string& name)
         if(it != pool->end())
         {
             cur_anim = &it->second;
+            cursor = animation::cursor();
             loop_time = max(loop_time, cur_anim->get_loop_time());
         }
     }
@@ -158,7 +167,8 @@ void animation_updater::handle(ecs& ctx, const update& e)
         a.update(e.delta);
         if(a.is_playing())
         {
-            if(a.cur_anim) a.cur_anim->apply(t, a.get_animation_time());
+            if(a.cur_anim)
+                a.cur_anim->apply(t, a.get_animation_time(), a.cursor);
         }
     });
 }
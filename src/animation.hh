@@ -180,6 +180,7 @@ private:
 class animation
 {
 public:
+    // Keyframes are given in this form, but stored as separate arrays.
     template<typename T>
     struct sample
     {
@@ -190,6 +191,15 @@ public:
         T out_tangent;
     };
 
+    // Remembers where in each track the previous apply() was, so that
+    // playing forward only has to step over the keyframes passed since.
+    struct cursor
+    {
+        uint32_t position = UINT32_MAX;
+        uint32_t scaling = UINT32_MAX;
+        uint32_t orientation = UINT32_MAX;
+    };
+
     enum interpolation
     {
         LINEAR = 0,
@@ -220,26 +230,34 @@ public:
         const std::vector<sample<mat4>>& transform
     );
 
+    // The whole local transform of the node is written at once.
     void apply(transformable& node, time_ticks time) const;
+    void apply(transformable& node, time_ticks time, cursor& c) const;
     time_ticks get_loop_time() const;
 
 private:
-    void determine_loop_time();
-
     template<typename T>
-    T interpolate(
-        time_ticks time,
-        const std::vector<sample<T>>& data,
-        interpolation interp
-    ) const;
+    struct track
+    {
+        interpolation interp = LINEAR;
+        std::vector<time_ticks> timestamps;
+        std::vector<T> values;
+        // Only stored for CUBICSPLINE, the in and out tangents of each
+        // keyframe one after the other.
+        std::vector<T> tangents;
+
+        void assign(interpolation interp, const std::vector<sample<T>>& samples);
+        // Returns the index of the first keyframe after the given time.
+        uint32_t find(time_ticks time, uint32_t& cursor) const;
+        T interpolate(time_ticks time, uint32_t& cursor) const;
+    };
+
+    void determine_loop_time();
 
     time_ticks loop_time;
-    interpolation position_interpolation;
-    std::vector<sample<vec3>> position;
-    interpolation scaling_interpolation;
-    std::vector<sample<vec3>> scaling;
-    interpolation orientation_interpolation;
-    std::vector<sample<quat>> orientation;
+    track<vec3> position;
+    track<vec3> scaling;
+    track<quat> orientation;
 }; 
 
 using animation_pool = std::unordered_map<std::string /*name*/, animation>;
@@ -298,6 +316,7 @@ public:
 
     const animation_pool* pool;
     const animation* cur_anim;
+    animation::cursor cursor;
 
 protected:
     time_ticks set_animation(const std::string& name);
@@ -3,43 +3,78 @@
 #include <algorithm>
 
 template<typename T>
-T animation::interpolate(
-    time_ticks time,
-    const std::vector<sample<T>>& data,
-    interpolation interp
-) const
+void animation::track<T>::assign(
+    interpolation interp, const std::vector<sample<T>>& samples
+){
+    this->interp = interp;
+    timestamps.resize(samples.size());
+    values.resize(samples.size());
+    tangents.clear();
+    if(interp == CUBICSPLINE)
+        tangents.resize(samples.size()*2);
+    for(size_t i = 0; i < samples.size(); ++i)
+    {
+        timestamps[i] = samples[i].timestamp;
+        values[i] = samples[i].data;
+        if(interp == CUBICSPLINE)
+        {
+            tangents[i*2] = samples[i].in_tangent;
+            tangents[i*2+1] = samples[i].out_tangent;
+        }
+    }
+}
+
+template<typename T>
+uint32_t animation::track<T>::find(time_ticks time, uint32_t& cursor) const
 {
-    auto it = std::upper_bound(
-        data.begin(), data.end(), time,
-        [](timestamp time, const sample<T>& s){ return time < s.timestamp; }
-    );
-    if(it == data.end()) return data.back().data;
-    if(it == data.begin()) return data.front().data;
-
-    auto prev = it-1;
-    float frame_ticks = it->timestamp-prev->timestamp;
-    float ratio = (time-prev->timestamp)/frame_ticks;
+    uint32_t count = timestamps.size();
+    // The cursor is only usable if it's not past the time, which happens
+    // when the animation loops or starts over.
+    if(cursor > count || (cursor > 0 && timestamps[cursor-1] > time))
+    {
+        cursor = std::upper_bound(
+            timestamps.begin(), timestamps.end(), time
+        ) - timestamps.begin();
+    }
+    else
+    {
+        while(cursor < count && timestamps[cursor] <= time)
+            cursor++;
+    }
+    return cursor;
+}
+
+template<typename T>
+T animation::track<T>::interpolate(time_ticks time, uint32_t& cursor) const
+{
+    uint32_t next = find(time, cursor);
+    if(next == values.size()) return values.back();
+    if(next == 0) return values.front();
+
+    uint32_t prev = next-1;
+    float frame_ticks = timestamps[next]-timestamps[prev];
+    float ratio = (time-timestamps[prev])/frame_ticks;
     switch(interp)
     {
     default:
     case LINEAR:
-        return numeric_mixer<T>()(prev->data, it->data, ratio);
+        return numeric_mixer<T>()(values[prev], values[next], ratio);
     case STEP:
-        return prev->data;
+        return values[prev];
     case CUBICSPLINE:
         {
             // Scale factor has to use seconds unfortunately.
             float scale = frame_ticks * 0.000001f;
             return cubic_spline(
-                prev->data,
-                prev->out_tangent*scale,
-                it->data,
-                it->in_tangent*scale,
+                values[prev],
+                tangents[prev*2+1]*scale,
+                values[next],
+                tangents[next*2]*scale,
                 ratio
             );
         }
     case SMOOTHSTEP:
-        return numeric_mixer<T>()(prev->data, it->data, smoothstep(0.0f, 1.0f, ratio));
+        return numeric_mixer<T>()(values[prev], values[next], smoothstep(0.0f, 1.0f, ratio));
     }
 }
 
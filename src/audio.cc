@@ -1,16 +1,34 @@
 #include "audio.hh"
 #include "transformable.hh"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 
-audio::audio()
+audio::audio(uint32_t samplerate, uint32_t buffer_size)
 : listener(nullptr)
 {
+    set_format(samplerate, buffer_size);
+}
+
+void audio::set_format(uint32_t samplerate, uint32_t buffer_size)
+{
+    soloud.deinit();
+    sources.clear();
+    // 0 is SoLoud's AUTO. SDL is allowed to change the rate, so this ends up
+    // at the native rate of the device.
     soloud.init(
         0,
         SoLoud::Soloud::SDL2,
-        48000,
-        512
+        samplerate,
+        buffer_size
     );
+    if(samplerate != 0 && get_samplerate() != samplerate)
+    {
+        printf(
+            "Audio device opened at %u Hz instead of %u Hz\n",
+            get_samplerate(), samplerate
+        );
+    }
 }
 
 audio::~audio()
@@ -103,53 +121,88 @@ void audio::remove_source(SoLoud::handle h)
 }
 
 audio_ring_buffer::audio_ring_buffer(size_t sample_count, size_t channels)
-: read_head(0), write_head(0), unread_samples(0), sample_count(sample_count),
-  channels(channels), buffer(sample_count*channels, 0.0f)
+:   channels(channels), read_head(0), cached_write_head(0), write_head(0),
+    cached_read_head(0)
 {
+    size_t capacity = 1;
+    while(capacity < sample_count) capacity <<= 1;
+    mask = capacity-1;
+    buffer.resize(capacity*channels, 0.0f);
 }
 
 void audio_ring_buffer::pop(float* stream, size_t sample_count)
 {
+    size_t capacity = mask+1;
+    size_t head = read_head.load(std::memory_order_relaxed);
+    if(cached_write_head - head < sample_count)
+        cached_write_head = write_head.load(std::memory_order_acquire);
+    size_t count = std::min(cached_write_head - head, sample_count);
+
     // The pop occurs in the order expected by SoLoud, so it's not interleaved.
-    size_t i = 0;
-    for(; i < sample_count && unread_samples > 0; ++i)
+    size_t start = head & mask;
+    size_t first = std::min(count, capacity - start);
+    for(size_t j = 0; j < channels; ++j)
     {
-        for(size_t j = 0; j < channels; ++j)
-        {
-            stream[i+sample_count*j] = buffer[read_head*channels+j];
-        }
-        read_head = (read_head+1) % this->sample_count;
-        unread_samples--;
+        const float* plane = buffer.data() + j*capacity;
+        float* out = stream + j*sample_count;
+        memcpy(out, plane + start, first*sizeof(float));
+        memcpy(out + first, plane, (count-first)*sizeof(float));
+        // Fill the rest with zeroes if we underflowed.
+        std::fill(out + count, out + sample_count, 0.0f);
     }
+    read_head.store(head + count, std::memory_order_release);
+}
+
+size_t audio_ring_buffer::push(const int16_t* samples, size_t sample_count)
+{
+    size_t capacity = mask+1;
+    size_t tail = write_head.load(std::memory_order_relaxed);
+    if(capacity - (tail - cached_read_head) < sample_count)
+        cached_read_head = read_head.load(std::memory_order_acquire);
+    // On overflow, the samples that don't fit are dropped.
+    size_t count = std::min(capacity - (tail - cached_read_head), sample_count);
+
+    size_t start = tail & mask;
+    size_t first = std::min(count, capacity - start);
+    deinterleave(samples, first, buffer.data() + start);
+    deinterleave(samples + first*channels, count - first, buffer.data());
+    write_head.store(tail + count, std::memory_order_release);
+    return count;
+}
 
-    //if(i < sample_count)
-    //    printf("Audio underflow!\n");
+size_t audio_ring_buffer::get_unread_sample_count() const
+{
+    return write_head.load(std::memory_order_acquire) -
+        read_head.load(std::memory_order_acquire);
+}
 
-    // Fill the rest with zeroes if we underflowed.
-    for(; i < sample_count; ++i)
+size_t audio_ring_buffer::get_capacity() const
+{
+    return mask+1;
+}
+
+void audio_ring_buffer::deinterleave(
+    const int16_t* samples, size_t sample_count, float* out
+){
+    // Written as simple loops over contiguous outputs so that they vectorize.
+    size_t capacity = mask+1;
+    constexpr float scale = 1.0f/32768.0f;
+    if(channels == 2)
     {
-        for(size_t j = 0; j < channels; ++j)
+        float* left = out;
+        float* right = out + capacity;
+        for(size_t i = 0; i < sample_count; ++i)
         {
-            stream[i+sample_count*j] = 0.0f;
+            left[i] = samples[i*2] * scale;
+            right[i] = samples[i*2+1] * scale;
         }
+        return;
     }
-}
 
-void audio_ring_buffer::push(int16_t left, int16_t right)
-{
-    if(unread_samples == sample_count)
+    for(size_t j = 0; j < channels; ++j)
     {
-        //printf("Audio overflow!\n");
-        return; // overflow! Don't push more.
+        float* plane = out + j*capacity;
+        for(size_t i = 0; i < sample_count; ++i)
+            plane[i] = samples[i*channels+j] * scale;
     }
-
-    buffer[write_head*channels] = left/32768.0f;
-    buffer[write_head*channels+1] = right/32768.0f;
-    write_head = (write_head+1) % sample_count;
-    unread_samples++;
-}
-
-size_t audio_ring_buffer::get_unread_sample_count() const
-{
-    return unread_samples;
 }
@@ -10,9 +10,17 @@ class transformable;
 class audio
 {
 public:
-    audio();
+    // A samplerate of 0 uses the native rate of the device. The buffer size
+    // is in samples.
+    audio(uint32_t samplerate = 0, uint32_t buffer_size = 512);
     ~audio();
 
+    // Restarts the backend with a different format. All sources are
+    // removed and must be added again.
+    void set_format(uint32_t samplerate, uint32_t buffer_size);
+
+    // The format the backend actually got, which may differ from the
+    // requested one.
     uint32_t get_samplerate();
     uint32_t get_buffer_size();
     void update();
@@ -30,25 +38,44 @@ private:
     SoLoud::Soloud soloud;
 };
 
-// Assumes that reader and writer are in different threads, but there is only
-// one of each. The ring buffer cannot be resized after creation. Assuming
-// atomic_size_t is lockless, the algorithm is lockless.
+// Lock-free ring of audio samples from one reader thread to one writer
+// thread. The capacity is fixed at creation and rounded up to a power of two.
+// Channels are stored in separate planes, which is the layout SoLoud reads,
+// so popping is just a copy. The read and write indices live on separate
+// cache lines, and each side caches the other's index so that the lines only
+// move between cores when the cached value runs out.
 class audio_ring_buffer
 {
 public:
     audio_ring_buffer(size_t sample_count, size_t channels);
 
+    // Reader side. Writes sample_count samples of each channel, one channel
+    // after the other. If there aren't enough samples, the rest is silence.
     void pop(float* stream, size_t sample_count);
-    void push(int16_t left, int16_t right);
+
+    // Writer side. The samples are interleaved. Returns how many samples
+    // were pushed, which is less than sample_count if the ring is full.
+    size_t push(const int16_t* samples, size_t sample_count);
+
     size_t get_unread_sample_count() const;
+    size_t get_capacity() const;
 
 private:
-    size_t read_head;
-    size_t write_head;
-    std::atomic_size_t unread_samples;
-    size_t sample_count;
+    // Converts interleaved samples into the planes, starting from out.
+    void deinterleave(
+        const int16_t* samples, size_t sample_count, float* out
+    );
+
+    size_t mask;
     size_t channels;
     std::vector<float> buffer;
+
+    // Only written by the reader.
+    alignas(64) std::atomic_size_t read_head;
+    size_t cached_write_head;
+    // Only written by the writer.
+    alignas(64) std::atomic_size_t write_head;
+    size_t cached_read_head;
 };
 
 #endif
@@ -0,0 +1,212 @@
+#include "emulator.hh"
+#include "thread_pool.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+// Headless batch runner for ROM compatibility and regression sweeps. Runs
+// every ROM listed in a job file on its own emulator instance, spread over
+// all cores, and prints a line of results per ROM. Each line of the job file
+// is
+//
+//     rom_file frame_count [input_script]
+//
+// where the optional input script has lines of the form
+//
+//     frame button down|up
+//
+// Empty lines and lines starting with '#' are ignored in both.
+namespace
+{
+
+struct input_event
+{
+    uint64_t frame;
+    GB_key_t button;
+    bool pressed;
+};
+
+struct batch_job
+{
+    std::string rom;
+    unsigned frames;
+    std::string input_script;
+};
+
+struct batch_result
+{
+    std::string error;
+    uint64_t ticks = 0;
+    double host_seconds = 0;
+    uint64_t framebuffer_hash = 0;
+    uint64_t audio_hash = 0;
+};
+
+bool skip_line(const std::string& line)
+{
+    size_t start = line.find_first_not_of(" \t\r");
+    return start == std::string::npos || line[start] == '#';
+}
+
+bool read_jobs(const std::string& path, std::vector<batch_job>& jobs)
+{
+    std::ifstream f(path);
+    if(!f) return false;
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        if(skip_line(line)) continue;
+        std::stringstream ss(line);
+        batch_job job;
+        if(!(ss >> job.rom >> job.frames))
+        {
+            fprintf(stderr, "Invalid job: %s\n", line.c_str());
+            return false;
+        }
+        ss >> job.input_script;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool read_input_script(
+    const std::string& path, std::vector<input_event>& events
+){
+    static const std::unordered_map<std::string, GB_key_t> buttons = {
+        {"right", GB_KEY_RIGHT},
+        {"left", GB_KEY_LEFT},
+        {"up", GB_KEY_UP},
+        {"down", GB_KEY_DOWN},
+        {"a", GB_KEY_A},
+        {"b", GB_KEY_B},
+        {"select", GB_KEY_SELECT},
+        {"start", GB_KEY_START}
+    };
+
+    std::ifstream f(path);
+    if(!f) return false;
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        if(skip_line(line)) continue;
+        std::stringstream ss(line);
+        input_event e;
+        std::string button, state;
+        if(!(ss >> e.frame >> button >> state))
+            return false;
+        auto it = buttons.find(button);
+        if(it == buttons.end() || (state != "down" && state != "up"))
+            return false;
+        e.button = it->second;
+        e.pressed = state == "down";
+        events.push_back(e);
+    }
+    std::stable_sort(
+        events.begin(), events.end(),
+        [](const input_event& a, const input_event& b){
+            return a.frame < b.frame;
+        }
+    );
+    return true;
+}
+
+batch_result run_job(const batch_job& job)
+{
+    batch_result res;
+    std::vector<input_event> events;
+    if(job.input_script.size() && !read_input_script(job.input_script, events))
+    {
+        res.error = "Failed to read input script " + job.input_script;
+        return res;
+    }
+
+    emulator emu;
+    emu.set_power(true);
+    if(!emu.load_rom(job.rom))
+    {
+        res.error = "Failed to load ROM";
+        return res;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(const input_event& e: events)
+    {
+        if(e.frame >= job.frames) break;
+        if(e.frame > emu.get_frame_count())
+            res.ticks += emu.run_frames(e.frame - emu.get_frame_count());
+        emu.set_button(e.button, e.pressed);
+    }
+    if(job.frames > emu.get_frame_count())
+        res.ticks += emu.run_frames(job.frames - emu.get_frame_count());
+    auto end = std::chrono::steady_clock::now();
+
+    res.host_seconds = std::chrono::duration<double>(end - start).count();
+    uvec2 size = emulator::get_screen_size();
+    res.framebuffer_hash = fnv1a(
+        emu.get_framebuffer_data(), sizeof(uint32_t)*size.x*size.y
+    );
+    res.audio_hash = emu.get_audio_hash();
+    return res;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s job_file [thread_count]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<batch_job> jobs;
+    if(!read_jobs(argv[1], jobs))
+    {
+        fprintf(stderr, "Failed to read job file %s\n", argv[1]);
+        return 1;
+    }
+
+    thread_pool pool(
+        argc == 3 ?
+        strtoul(argv[2], nullptr, 10) :
+        std::thread::hardware_concurrency()
+    );
+
+    std::vector<batch_result> results(jobs.size());
+    auto start = std::chrono::steady_clock::now();
+    pool.parallel_for(jobs.size(), [&](size_t i){
+        results[i] = run_job(jobs[i]);
+    });
+    auto end = std::chrono::steady_clock::now();
+
+    int failed = 0;
+    printf("rom,frames,cycles_per_second,framebuffer_hash,audio_hash\n");
+    for(size_t i = 0; i < jobs.size(); ++i)
+    {
+        const batch_result& res = results[i];
+        if(res.error.size())
+        {
+            fprintf(stderr, "%s: %s\n", jobs[i].rom.c_str(), res.error.c_str());
+            failed++;
+            continue;
+        }
+        printf(
+            "%s,%u,%.0f,%016llx,%016llx\n",
+            jobs[i].rom.c_str(), jobs[i].frames, res.ticks/res.host_seconds,
+            (unsigned long long)res.framebuffer_hash,
+            (unsigned long long)res.audio_hash
+        );
+    }
+
+    fprintf(
+        stderr, "Ran %zu ROMs on %u threads in %.3f s, %d failed\n",
+        jobs.size(), pool.get_thread_count(),
+        std::chrono::duration<double>(end - start).count(), failed
+    );
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#include "emulator.hh"
+#include "link_cable.hh"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// Headless emulation throughput benchmark. Runs a ROM for a fixed number of
+// frames, or through a recorded input movie, without any rendering or audio
+// output and reports how much faster than real time the emulator core
+// manages to run. Movie runs can also dump a hash of every frame, for
+// checking that replays stay bit-exact. Link runs emulate two ROMs connected
+// with a link cable, each on its own thread. Link checks do the same with
+// test ROMs that count their correct and incorrect exchanges at $C000 and
+// $C001 and set $C002 when done, like the ones from tests/link_handshake.py.
+// WAV runs write all generated audio into a file, with or without the
+// high-pass filter and interference.
+namespace
+{
+
+// Where the link test ROMs leave their results.
+constexpr uint16_t LINK_CHECK_GOOD = 0xC000;
+constexpr uint16_t LINK_CHECK_BAD = 0xC001;
+constexpr uint16_t LINK_CHECK_DONE = 0xC002;
+
+int run_link(const char* rom_a, const char* rom_b, unsigned frames, bool check)
+{
+    emulator emus[2];
+    const char* roms[2] = {rom_a, rom_b};
+    for(unsigned i = 0; i < 2; ++i)
+    {
+        emus[i].set_power(true);
+        if(!emus[i].load_rom(roms[i]))
+        {
+            fprintf(stderr, "Failed to load ROM %s\n", roms[i]);
+            return 1;
+        }
+        emus[i].print_info();
+    }
+
+    link_cable cable(emus[0], emus[1]);
+    uint64_t ticks[2] = {0, 0};
+    double host_seconds[2] = {0, 0};
+    std::thread threads[2];
+    for(unsigned i = 0; i < 2; ++i)
+    {
+        threads[i] = std::thread([&, i](){
+            auto start = std::chrono::steady_clock::now();
+            ticks[i] = emus[i].run_frames(frames);
+            auto end = std::chrono::steady_clock::now();
+            host_seconds[i] = std::chrono::duration<double>(end - start).count();
+        });
+    }
+    for(std::thread& t: threads)
+        t.join();
+
+    for(unsigned i = 0; i < 2; ++i)
+    {
+        double emulated_seconds = double(ticks[i])/double(TICKS_PER_SECOND);
+        printf("Side %u:\n", i+1);
+        printf("  Emulated cycles:  %llu\n", (unsigned long long)ticks[i]);
+        printf("  Host time:        %.3f s\n", host_seconds[i]);
+        printf("  Cycles/s:         %.0f\n", ticks[i]/host_seconds[i]);
+        printf("  Speed-up:         %.2fx\n", emulated_seconds/host_seconds[i]);
+    }
+    printf("Transferred bits: %llu\n", (unsigned long long)cable.get_transferred_bits());
+    printf("Link stalls:      %llu\n", (unsigned long long)cable.get_stall_count());
+    if(!check) return 0;
+
+    bool passed = true;
+    for(unsigned i = 0; i < 2; ++i)
+    {
+        unsigned good = emus[i].read_memory(LINK_CHECK_GOOD);
+        unsigned bad = emus[i].read_memory(LINK_CHECK_BAD);
+        bool done = emus[i].read_memory(LINK_CHECK_DONE) == 1;
+        printf(
+            "Side %u handshake: %u correct, %u incorrect, %s\n",
+            i+1, good, bad, done ? "finished" : "not finished"
+        );
+        passed = passed && done && bad == 0;
+    }
+    printf("Link check %s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bool movie_mode = argc >= 4 && strcmp(argv[2], "--movie") == 0;
+    bool link_check = argc >= 4 && strcmp(argv[2], "--link-check") == 0;
+    bool link_mode = link_check || (argc >= 4 && strcmp(argv[2], "--link") == 0);
+    bool raw_wav = argc >= 4 && strcmp(argv[2], "--wav-raw") == 0;
+    bool wav_mode = raw_wav || (argc >= 4 && strcmp(argv[2], "--wav") == 0);
+    bool pair_mode = movie_mode || link_mode || wav_mode;
+    if(argc < 2 || (pair_mode ? argc > 5 : argc > 3))
+    {
+        fprintf(
+            stderr,
+            "Usage: %s rom_file [frame_count]\n"
+            "       %s rom_file --movie movie_file [hash_file]\n"
+            "       %s rom_file --link|--link-check other_rom_file [frame_count]\n"
+            "       %s rom_file --wav|--wav-raw wav_file [frame_count]\n",
+            argv[0], argv[0], argv[0], argv[0]
+        );
+        return 1;
+    }
+
+    unsigned frames = 3600;
+    if(!pair_mode && argc == 3)
+        frames = strtoul(argv[2], nullptr, 10);
+    if((link_mode || wav_mode) && argc == 5)
+        frames = strtoul(argv[4], nullptr, 10);
+    if(frames == 0)
+    {
+        fprintf(stderr, "Frame count must be a positive integer\n");
+        return 1;
+    }
+    if(link_mode)
+        return run_link(argv[1], argv[3], frames, link_check);
+
+    emulator emu;
+    if(raw_wav) emu.set_audio_filters(false, false);
+    emu.set_power(true);
+    if(!emu.load_rom(argv[1]))
+    {
+        fprintf(stderr, "Failed to load ROM %s\n", argv[1]);
+        return 1;
+    }
+    emu.print_info();
+
+    FILE* hash_file = nullptr;
+    if(movie_mode)
+    {
+        if(!emu.play_movie(argv[3]))
+            return 1;
+        if(argc == 5 && !(hash_file = fopen(argv[4], "w")))
+        {
+            fprintf(stderr, "Failed to open %s\n", argv[4]);
+            return 1;
+        }
+    }
+    if(wav_mode && !emu.start_audio_dump(argv[3]))
+        return 1;
+
+    uvec2 size = emulator::get_screen_size();
+    uint64_t ticks = 0;
+    auto start = std::chrono::steady_clock::now();
+    if(movie_mode)
+    {
+        frames = 0;
+        while(emu.is_playing_movie())
+        {
+            ticks += emu.run_frames(1);
+            frames++;
+            if(hash_file)
+            {
+                uint64_t hash = fnv1a(
+                    emu.get_framebuffer_data(), sizeof(uint32_t)*size.x*size.y
+                );
+                fprintf(hash_file, "%u %016llx\n", frames, (unsigned long long)hash);
+            }
+        }
+    }
+    else ticks = emu.run_frames(frames);
+    auto end = std::chrono::steady_clock::now();
+    if(hash_file) fclose(hash_file);
+    bool wav_written = !wav_mode || emu.stop_audio_dump();
+
+    double host_seconds = std::chrono::duration<double>(end - start).count();
+    double emulated_seconds = double(ticks)/double(TICKS_PER_SECOND);
+
+    printf("Frames:           %u\n", frames);
+    printf("Emulated cycles:  %llu\n", (unsigned long long)ticks);
+    printf("Emulated time:    %.3f s\n", emulated_seconds);
+    printf("Host time:        %.3f s\n", host_seconds);
+    printf("Cycles/s:         %.0f\n", ticks/host_seconds);
+    printf("Frames/s:         %.1f\n", frames/host_seconds);
+    printf("Speed-up:         %.2fx\n", emulated_seconds/host_seconds);
+    if(wav_mode)
+        printf("Audio hash:       %016llx\n", (unsigned long long)emu.get_audio_hash());
+    return wav_written ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #ifndef RAYBOY_ECS_HH
 #define RAYBOY_ECS_HH
 #include "monkeroecs.hh"
+#include "thread_pool.hh"
 #include <chrono>
 
 using namespace monkero;
@@ -26,4 +27,22 @@ private:
     std::chrono::steady_clock::time_point prev_update;
 };
 
+// Like ecs::foreach(), but the entities are split into batches of batch_size
+// and handed out to the thread pool. Each entity can produce a number of
+// output entries; count_func(id, components...) is first called for every
+// entity on the calling thread, in iteration order, and returns that number.
+// func(id, offset, components...) then gets the index of the first entry of
+// the entity, as if all entries were packed one after another in iteration
+// order. func must only touch state of its own entity. Returns the total
+// number of entries.
+template<typename... Components, typename CountFunc, typename Func>
+size_t parallel_foreach(
+    ecs& ctx,
+    thread_pool& pool,
+    size_t batch_size,
+    CountFunc&& count_func,
+    Func&& func
+);
+
+#include "ecs.tcc"
 #endif
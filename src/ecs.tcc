@@ -0,0 +1,68 @@
+#ifndef RAYBOY_ECS_TCC
+#define RAYBOY_ECS_TCC
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+// Components are passed by reference, except for optional ones which are
+// asked for as pointers, like with ecs::foreach().
+template<typename T>
+struct component_arg
+{
+    using type = T&;
+    static T* ptr(T& c) { return &c; }
+    static T& get(T* p) { return *p; }
+};
+
+template<typename T>
+struct component_arg<T*>
+{
+    using type = T*;
+    static T* ptr(T* c) { return c; }
+    static T* get(T* p) { return p; }
+};
+
+template<typename... Components, typename CountFunc, typename Func>
+size_t parallel_foreach(
+    ecs& ctx,
+    thread_pool& pool,
+    size_t batch_size,
+    CountFunc&& count_func,
+    Func&& func
+){
+    struct item
+    {
+        entity id;
+        size_t offset;
+        std::tuple<std::remove_pointer_t<Components>*...> components;
+    };
+
+    // Gathering is sequential, and the offsets are an exclusive prefix sum of
+    // the counts.
+    std::vector<item> items;
+    size_t total = 0;
+    ctx([&](entity id, typename component_arg<Components>::type... c){
+        size_t count = count_func(id, c...);
+        items.push_back({id, total, {component_arg<Components>::ptr(c)...}});
+        total += count;
+    });
+
+    size_t batch_count = (items.size() + batch_size - 1) / batch_size;
+    auto run_batch = [&](size_t batch){
+        size_t end = std::min(items.size(), (batch+1) * batch_size);
+        for(size_t i = batch * batch_size; i < end; ++i)
+        {
+            const item& it = items[i];
+            std::apply([&](auto*... c){
+                func(it.id, it.offset, component_arg<Components>::get(c)...);
+            }, it.components);
+        }
+    };
+
+    // Not worth waking up the pool for.
+    if(batch_count == 1) run_batch(0);
+    else pool.parallel_for(batch_count, run_batch);
+    return total;
+}
+
+#endif
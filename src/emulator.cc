@@ -1,12 +1,87 @@
 #include "emulator.hh"
+#include "link_cable.hh"
 #include "io.hh"
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#define TICKS_PER_SECOND 0x800000
 
 namespace
 {
 
+// The speed budget of run-ahead is checked over this many real frames.
+constexpr unsigned RUN_AHEAD_WINDOW = 60;
+// Run-ahead is turned off if it takes more than this portion of real time.
+constexpr double RUN_AHEAD_BUDGET = 0.8;
+// During turbo, frames are drawn at most this often in host time.
+constexpr std::chrono::microseconds TURBO_FRAME_INTERVAL(16667);
+// Uncapped turbo doesn't follow any clock, so it emulates fixed slices of
+// about a frame.
+constexpr uint64_t TURBO_SLICE_TICKS = TICKS_PER_SECOND/60;
+// Lowest rate the APU is decimated down to.
+constexpr uint32_t TURBO_MIN_SAMPLERATE = 1000;
+// Enough for several minutes of history in most games.
+constexpr size_t REWIND_BUDGET = 64*1024*1024;
+// A rewind state is captured this often, in frames. Every frame is kept, so
+// that rewinding plays back at the normal frame rate.
+constexpr unsigned REWIND_INTERVAL = 1;
+// Each rewind step is shown for about a frame.
+constexpr std::chrono::microseconds REWIND_STEP_INTERVAL(16667);
+// Largest supported audio buffer length; the ring has room for a few.
+constexpr uint32_t MAX_AUDIO_BUFFER_LENGTH = 4096;
+// Slices are emulated this many times per audio buffer length.
+constexpr unsigned SLICES_PER_BUFFER = 4;
+// Longest host time made up for at once, e.g. after the thread was stalled.
+constexpr double MAX_PACE_STEP = 0.1;
+// The audio rate is adjusted by at most this much, far below audible pitch
+// changes.
+constexpr double MAX_RATE_ADJUSTMENT = 0.005;
+// Time constant of the audio fill level smoothing, in seconds. Several
+// backend pulls long.
+constexpr double FILL_SMOOTHING_TIME = 0.1;
+// Audio samples are passed on in blocks of this many, or at the end of each
+// slice.
+constexpr size_t AUDIO_BLOCK_SIZE = 256;
+// Profiling results are published this often.
+constexpr std::chrono::seconds PROFILE_WINDOW(1);
+
+// Locks the mutex like usual, but adds up the time spent waiting for other
+// threads to let go of it.
+class timed_lockable
+{
+public:
+    timed_lockable(
+        std::recursive_mutex& mutex,
+        std::chrono::steady_clock::duration& wait_time
+    ): mutex(mutex), wait_time(wait_time)
+    {
+    }
+
+    void lock()
+    {
+        if(mutex.try_lock()) return;
+        auto start = std::chrono::steady_clock::now();
+        mutex.lock();
+        wait_time += std::chrono::steady_clock::now() - start;
+    }
+
+    bool try_lock() { return mutex.try_lock(); }
+    void unlock() { mutex.unlock(); }
+
+private:
+    std::recursive_mutex& mutex;
+    std::chrono::steady_clock::duration& wait_time;
+};
+
+double per_second(
+    std::chrono::steady_clock::duration time,
+    std::chrono::steady_clock::duration window
+){
+    return std::chrono::duration<double>(time).count() /
+        std::chrono::duration<double>(window).count();
+}
+
 class emulator_audio_instance: public SoLoud::AudioSourceInstance
 {
 public:
@@ -44,9 +119,12 @@ public:
     }
 } emulator_attenuator_instance;
 
+// SameBoy only calls this when palettes change. With color correction
+// disabled, the 8-bit channels are just the 5-bit ones scaled up, so this
+// gets the original 15-bit colors back. Decoding is left to the GPU.
 uint32_t rgb_encode(GB_gameboy_t* gb, uint8_t r, uint8_t g, uint8_t b)
 {
-    return uint32_t(r)|(uint32_t(g)<<8)|(uint32_t(b)<<16)|0xFF000000;
+    return uint32_t(r>>3)|(uint32_t(g>>3)<<5)|(uint32_t(b>>3)<<10);
 }
 
 void log_callback(GB_gameboy_t*, const char*, GB_log_attributes) {}
@@ -54,7 +132,7 @@ void log_callback(GB_gameboy_t*, const char*, GB_log_attributes) {}
 }
 
 emulator_audio::emulator_audio(uint32_t buffer_length, uint32_t samplerate)
-: buf(buffer_length*4, 2), buffer_length(buffer_length)
+: buffer_length(buffer_length), buf(MAX_AUDIO_BUFFER_LENGTH*4, 2)
 {
     mBaseSamplerate = samplerate;
     mChannels = 2;
@@ -62,25 +140,43 @@ emulator_audio::emulator_audio(uint32_t buffer_length, uint32_t samplerate)
     m3dMinDistance = 0.01;
 }
 
+void emulator_audio::set_format(uint32_t buffer_length, uint32_t samplerate)
+{
+    this->buffer_length = std::min(buffer_length, MAX_AUDIO_BUFFER_LENGTH);
+    mBaseSamplerate = samplerate;
+}
+
 emulator_audio::~emulator_audio()
 {
     stop();
 }
 
-void emulator_audio::push_sample(GB_sample_t* sample)
+void emulator_audio::push_samples(const GB_sample_t* samples, size_t count)
+{
+    // GB_sample_t is just the two interleaved channels.
+    buf.push((const int16_t*)samples, count);
+}
+
+uint32_t emulator_audio::get_samplerate() const
 {
-    buf.push(sample->left, sample->right);
+    return mBaseSamplerate;
 }
 
-int emulator_audio::get_sample_status() const
+size_t emulator_audio::get_unread_sample_count() const
 {
-    // If we don't have enough samples for the next getAudio call, we're
-    // kinda in trouble.
-    size_t samples = buf.get_unread_sample_count();
-    if(samples < buffer_length*2) return -1;
-    if(samples > buffer_length*3) return 1;
-    if(samples >= buffer_length*4-1) return 2;
-    return 0;
+    return buf.get_unread_sample_count();
+}
+
+size_t emulator_audio::get_target_fill() const
+{
+    return buffer_length;
+}
+
+std::chrono::microseconds emulator_audio::get_buffer_duration() const
+{
+    return std::chrono::microseconds(
+        buffer_length * 1000000 / (uint64_t)mBaseSamplerate
+    );
 }
 
 SoLoud::AudioSourceInstance* emulator_audio::createInstance()
@@ -88,17 +184,48 @@ SoLoud::AudioSourceInstance* emulator_audio::createInstance()
     return new emulator_audio_instance(&buf);
 }
 
+emulator::emulator()
+:   total_ticks(0), published_ticks(0), frame_count(0),
+    audio_hash(fnv1a(nullptr, 0)), audio_block(AUDIO_BLOCK_SIZE),
+    audio_block_size(0), audio_highpass(true), audio_interference(true),
+    powered(false), paused(false), destroy(false), fade_enabled(false), a(nullptr),
+    sav_generation(0), audio_output(SAMPLE_GRANULARITY, 48000), audio_handle(0),
+    audio_positional(nullptr), headless(true),
+    internal_framebuffers(3*160*144, 0xFFFFFFFF), run_ahead_frames(0),
+    run_ahead_remaining(0), in_run_ahead(false), vblank_occurred(false),
+    run_ahead_active(true), prev_vblank_ticks(0), run_ahead_window_ticks(0),
+    run_ahead_window_time(0), run_ahead_window_frames(0),
+    run_ahead_presented_frames(0), turbo_speed(1), frame_hidden(false),
+    apu_samplerate(48000), base_samplerate(48000),
+    pace_time(std::chrono::steady_clock::now()), pace_ticks(0),
+    smoothed_fill(0), rate_ratio(1), rewinding(false), frames_since_capture(0),
+    inputs(64), inputs_overflowed(false), has_next_input(false), next_input_ticks(0),
+    slice_start_ticks(0), movie_recording(false), movie_playing(false),
+    movie_start_ticks(0), movie_cursor(0), link(nullptr), link_side(0),
+    link_running(false), profile_window_start(std::chrono::steady_clock::now()),
+    profile_slice_time(0), profile_vblank_time(0), profile_audio_time(0),
+    profile_lock_wait_time(0), profile_link_wait_time(0), profile_run_calls(0),
+    profile_slices(0),
+    published_run_time(0), published_vblank_time(0), published_audio_time(0),
+    published_lock_wait_time(0), published_link_wait_time(0),
+    published_run_calls_per_slice(0),
+    published_slices_per_second(0), published_audio_buffered(0),
+    published_audio_rate_ratio(1), published_audio_latency(0),
+    published_audio_device_samplerate(0)
+{
+    set_framebuffer_slots({});
+    for(std::atomic_bool& state: button_states) state = false;
+    for(bool& state: core_button_states) state = false;
+}
+
 emulator::emulator(audio& a)
-:   powered(false), destroy(false), fade_enabled(false), a(&a),
-    audio_output(SAMPLE_GRANULARITY, 48000),
-    worker(&emulator::worker_func, this)
+: emulator()
 {
-    audio_handle = a.add_source(audio_output);
-    active_framebuffer.resize(160*144, 0xFFFFFFFF);
-    drive_framebuffer.resize(160*144, vec4(1));
-    faded_framebuffer.resize(160*144, vec4(1));
-    prev_faded_framebuffer.resize(160*144, vec4(1));
-    for(bool& state: button_states) state = false;
+    this->a = &a;
+    headless = false;
+    reset_audio_output();
+    rewind_history.reset(new rewind_buffer(REWIND_BUDGET));
+    worker = std::thread(&emulator::worker_func, this);
 }
 
 emulator::~emulator()
@@ -106,27 +233,44 @@ emulator::~emulator()
     {
         std::unique_lock lock(mutex);
         destroy = true;
+        wake.notify_all();
     }
-    worker.join();
+    if(worker.joinable())
+        worker.join();
     set_power(false);
 }
 
 void emulator::set_audio_mode(transformable* positional)
 {
+    if(!a) return;
     a->remove_source(audio_handle);
+    audio_positional = positional;
     audio_handle = a->add_source(audio_output, positional);
 }
 
+void emulator::reset_audio_output()
+{
+    std::unique_lock lock(mutex);
+    if(!a) return;
+    // Generating at the rate of the backend saves SoLoud from resampling.
+    audio_output.set_format(a->get_buffer_size(), a->get_samplerate());
+    published_audio_device_samplerate = a->get_samplerate();
+    set_turbo(turbo_speed);
+    audio_handle = a->add_source(audio_output, audio_positional);
+}
+
 void emulator::reset()
 {
     std::unique_lock lock(mutex);
+    end_movie();
     if(powered)
     {
         GB_reset(&gb);
     }
-    memset(active_framebuffer.data(), 0xFF, sizeof(uint32_t)*active_framebuffer.size());
-    // Faded framebuffer is intentionally not cleared here!
-    age_ticks = 0;
+    memset(
+        framebuffer_slots[frames.get_write_slot()], 0xFF,
+        sizeof(uint32_t)*160*144
+    );
 }
 
 bool emulator::load_rom(const std::string& path)
@@ -141,7 +285,15 @@ bool emulator::load_rom(const std::string& path)
         rom_path.replace_extension(".sav");
         sav = rom_path.string();
         GB_load_battery(&gb, sav.c_str());
+        mark_sav_clean();
+
+        if(rewind_history)
+        {
+            rewind_state.resize(GB_get_save_state_size(&gb));
+            rewind_history->reset(rewind_state.size());
+        }
 
+        wake.notify_all();
         return true;
     }
     else return false;
@@ -153,16 +305,33 @@ void emulator::load_sav(const std::string& path)
     reset();
     GB_load_battery(&gb, path.c_str());
     sav = path;
+    mark_sav_clean();
 }
 
 void emulator::save_sav()
 {
     std::unique_lock lock(mutex);
-    if(!sav.empty())
-    {
-        printf("Saving to %s\n", sav.c_str());
-        GB_save_battery(&gb, sav.c_str());
-    }
+    size_t size = powered ? GB_save_battery_size(&gb) : 0;
+    if(sav.empty() || size == 0)
+        return;
+
+    // The RTC isn't checked on purpose: the save stores the host time along
+    // with it, so an older save still loads the correct time.
+    size_t ram_size = 0;
+    uint8_t* ram = (uint8_t*)GB_get_direct_access(
+        &gb, GB_DIRECT_ACCESS_CART_RAM, &ram_size, nullptr
+    );
+    bool failed = sav_generation != 0 &&
+        sav_writer->get_failed_generation() >= sav_generation;
+    if(
+        !failed && ram_size == saved_cart_ram.size() &&
+        memcmp(ram, saved_cart_ram.data(), ram_size) == 0
+    ) return;
+    saved_cart_ram.assign(ram, ram + ram_size);
+
+    if(!sav_writer) sav_writer.reset(new save_writer());
+    GB_save_battery_to_buffer(&gb, sav_writer->begin_write(size), size);
+    sav_generation = sav_writer->end_write(sav);
 }
 
 void emulator::set_power(bool on)
@@ -178,13 +347,15 @@ void emulator::set_power(bool on)
         if(sav.size()) load_sav(sav);
     }
     else deinit_gb();
+    wake.notify_all();
 }
 
 void emulator::set_button(GB_key_t button, bool pressed)
 {
-    std::unique_lock lock(mutex);
-    if(powered) GB_set_key_state(&gb, button, pressed);
+    // The state goes first, the emulator reads it after seeing the overflow.
     button_states[button-GB_KEY_RIGHT] = pressed;
+    if(!inputs.push({std::chrono::steady_clock::now(), button, pressed}))
+        inputs_overflowed = true;
 }
 
 bool emulator::get_button(GB_key_t button)
@@ -203,6 +374,308 @@ void emulator::print_info()
     }
 }
 
+uint64_t emulator::run_frames(unsigned count)
+{
+    std::unique_lock lock(mutex);
+    if(!powered || rom.empty())
+        return 0;
+
+    uint64_t ticks = 0;
+    uint64_t target_frame = frame_count + count;
+    set_link_running(true);
+    while(frame_count < target_frame)
+    {
+        // There's no real time to follow, so inputs apply right away.
+        apply_inputs(true);
+        sync_link();
+        uint8_t step = GB_run(&gb);
+        ticks += step;
+        total_ticks += step;
+    }
+    flush_audio();
+    set_link_running(false);
+    published_ticks = total_ticks;
+    return ticks;
+}
+
+uint64_t emulator::get_frame_count() const
+{
+    return frame_count;
+}
+
+uint64_t emulator::get_audio_hash() const
+{
+    return audio_hash;
+}
+
+uint8_t emulator::read_memory(uint16_t address)
+{
+    std::unique_lock lock(mutex);
+    return powered ? GB_safe_read_memory(&gb, address) : 0xFF;
+}
+
+bool emulator::start_audio_dump(const std::string& path)
+{
+    std::unique_lock lock(mutex);
+    if(!headless) return false;
+    if(!audio_dump) audio_dump.reset(new wav_writer);
+    if(!audio_dump->open(path, apu_samplerate, 2))
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool emulator::stop_audio_dump()
+{
+    std::unique_lock lock(mutex);
+    if(!audio_dump || !audio_dump->is_open())
+        return true;
+    if(!audio_dump->close())
+    {
+        fprintf(stderr, "Failed to write the audio dump\n");
+        return false;
+    }
+    return true;
+}
+
+void emulator::set_audio_filters(bool highpass, bool interference)
+{
+    std::unique_lock lock(mutex);
+    audio_highpass = highpass;
+    audio_interference = interference;
+}
+
+void emulator::set_run_ahead(unsigned frames)
+{
+    std::unique_lock lock(mutex);
+    run_ahead_frames = frames;
+    run_ahead_active = true;
+    run_ahead_window_ticks = 0;
+    run_ahead_window_time = run_ahead_window_time.zero();
+    run_ahead_window_frames = 0;
+}
+
+void emulator::set_turbo(unsigned speed)
+{
+    std::unique_lock lock(mutex);
+    turbo_speed = speed;
+    // The APU generating fewer samples per emulated second is what decimates
+    // the audio; SameBoy resamples internally anyway.
+    base_samplerate = speed == 1 ? audio_output.get_samplerate() :
+        std::max(
+            audio_output.get_samplerate()/std::max(speed, 2u),
+            TURBO_MIN_SAMPLERATE
+        );
+    set_apu_samplerate(uint32_t(base_samplerate * rate_ratio));
+    if(speed == 1 && frame_hidden)
+    {
+        frame_hidden = false;
+        if(powered) GB_set_rendering_disabled(&gb, false);
+    }
+    wake.notify_all();
+}
+
+unsigned emulator::get_turbo() const
+{
+    return turbo_speed;
+}
+
+bool emulator::start_recording(const std::string& path)
+{
+    std::unique_lock lock(mutex);
+    if(!powered || rom.empty())
+        return false;
+
+    end_movie();
+    movie_recording = true;
+    set_rtc_mode();
+
+    movie = input_movie();
+    movie.rom_hash = get_rom_hash();
+    movie.initial_state.resize(GB_get_save_state_size(&gb));
+    GB_save_state_to_buffer(&gb, movie.initial_state.data());
+    // Buttons held at the start may not be part of the state.
+    for(unsigned i = 0; i < 8; ++i)
+        movie.events.push_back({0, uint8_t(GB_KEY_RIGHT+i), core_button_states[i]});
+    movie_path = path;
+    movie_start_ticks = total_ticks;
+    printf("Recording movie to %s\n", path.c_str());
+    return true;
+}
+
+bool emulator::play_movie(const std::string& path)
+{
+    std::unique_lock lock(mutex);
+    if(!powered || rom.empty())
+        return false;
+
+    end_movie();
+    if(!movie.read(path, GB_get_save_state_size(&gb)))
+    {
+        printf("Failed to read movie %s\n", path.c_str());
+        return false;
+    }
+    if(movie.rom_hash != get_rom_hash())
+    {
+        printf("Movie %s was recorded with a different ROM\n", path.c_str());
+        return false;
+    }
+    int err = GB_load_state_from_buffer(
+        &gb, movie.initial_state.data(), movie.initial_state.size()
+    );
+    if(err != 0)
+    {
+        printf("Movie %s has an invalid initial state\n", path.c_str());
+        return false;
+    }
+
+    movie_playing = true;
+    set_rtc_mode();
+    movie_path = path;
+    movie_start_ticks = total_ticks;
+    movie_cursor = 0;
+    wake.notify_all();
+    return true;
+}
+
+bool emulator::stop_movie()
+{
+    uint64_t generation;
+    {
+        std::unique_lock lock(mutex);
+        generation = end_movie();
+    }
+    // The emulator keeps going while this waits for the file.
+    return generation == 0 || movie_writer->wait(generation);
+}
+
+uint64_t emulator::end_movie()
+{
+    uint64_t generation = 0;
+    if(movie_recording)
+    {
+        // Like saves, the movie is written in the background instead of
+        // while holding the lock.
+        movie.length_ticks = total_ticks - movie_start_ticks;
+        if(!movie_writer) movie_writer.reset(new save_writer());
+        size_t size = movie.get_serialized_size();
+        movie.serialize(movie_writer->begin_write(size));
+        generation = movie_writer->end_write(movie_path);
+    }
+    else if(!movie_playing) return 0;
+
+    movie_recording = false;
+    movie_playing = false;
+    movie = input_movie();
+    if(powered) set_rtc_mode();
+    return generation;
+}
+
+bool emulator::is_recording_movie() const
+{
+    return movie_recording;
+}
+
+bool emulator::is_playing_movie() const
+{
+    return movie_playing;
+}
+
+void emulator::set_rewinding(bool rewinding)
+{
+    std::unique_lock lock(mutex);
+    // Rewinding would break the continuity of movies, and can't take back
+    // bits sent over the link cable.
+    this->rewinding = rewinding && rewind_history &&
+        !movie_recording && !movie_playing && !link;
+    frames_since_capture = 0;
+    wake.notify_all();
+}
+
+bool emulator::is_rewinding() const
+{
+    return rewinding;
+}
+
+void emulator::set_paused(bool paused)
+{
+    std::unique_lock lock(mutex);
+    this->paused = paused;
+    wake.notify_all();
+}
+
+bool emulator::is_paused() const
+{
+    return paused;
+}
+
+unsigned emulator::get_run_ahead() const
+{
+    return run_ahead_frames;
+}
+
+bool emulator::is_run_ahead_active() const
+{
+    return run_ahead_active;
+}
+
+void emulator::dump_timing() const
+{
+    std::cout << "Emulator:" << std::endl;
+    std::cout << "\t[run-ahead]: ";
+    if(run_ahead_frames == 0) std::cout << "off";
+    else
+    {
+        std::cout << run_ahead_frames << " frames";
+        if(!run_ahead_active) std::cout << " (disabled, too slow)";
+    }
+    std::cout << ", " << run_ahead_presented_frames << " frames presented"
+        << std::endl;
+    if(rewind_history)
+    {
+        std::cout << "\t[rewind]: "
+            << rewind_history->get_state_count() << " states, "
+            << rewind_history->get_used_memory()/(1024.0*1024.0) << " MB"
+            << std::endl;
+    }
+    if(!headless)
+    {
+        profile p = get_profile();
+        std::cout << "\t[GB_run]: " << p.run_time*1e3 << "ms/s" << std::endl;
+        std::cout << "\t[vblank]: " << p.vblank_time*1e3 << "ms/s" << std::endl;
+        std::cout << "\t[audio]: " << p.audio_time*1e3 << "ms/s" << std::endl;
+        std::cout << "\t[lock wait]: " << p.lock_wait_time*1e3 << "ms/s"
+            << std::endl;
+        std::cout << "\t[link wait]: " << p.link_wait_time*1e3 << "ms/s"
+            << std::endl;
+        std::cout << "\t[slices]: " << p.slices_per_second << "/s, "
+            << p.run_calls_per_slice << " GB_run calls each" << std::endl;
+        std::cout << "\t[audio buffer]: " << p.audio_buffered*1e3 << "ms, rate "
+            << (p.audio_rate_ratio-1.0)*100.0 << "% off" << std::endl;
+        std::cout << "\t[audio latency]: " << p.audio_latency*1e3 << "ms at "
+            << p.audio_device_samplerate << " Hz" << std::endl;
+    }
+}
+
+emulator::profile emulator::get_profile() const
+{
+    return {
+        published_run_time,
+        published_vblank_time,
+        published_audio_time,
+        published_lock_wait_time,
+        published_link_wait_time,
+        published_run_calls_per_slice,
+        published_slices_per_second,
+        published_audio_buffered,
+        published_audio_rate_ratio,
+        published_audio_latency,
+        published_audio_device_samplerate
+    };
+}
+
 uvec2 emulator::get_screen_size()
 {
     return uvec2(160, 144);
@@ -210,108 +683,461 @@ uvec2 emulator::get_screen_size()
 
 void emulator::set_framebuffer_fade(bool enable)
 {
-    std::unique_lock lock(mutex);
     fade_enabled = enable;
 }
 
-void emulator::lock_framebuffer()
+bool emulator::get_framebuffer_fade() const
 {
-    mutex.lock();
+    return fade_enabled;
 }
 
-const vec4* emulator::get_framebuffer_data()
+const uint32_t* emulator::get_framebuffer_data()
 {
-    if(fade_enabled)
+    int slot = frames.acquire(read_slot);
+    if(slot >= 0) read_slot = slot;
+    return framebuffer_slots[read_slot];
+}
+
+uint64_t emulator::get_framebuffer_timestamp() const
+{
+    return slot_timestamps[read_slot];
+}
+
+void emulator::set_framebuffer_slots(const std::vector<uint32_t*>& slots)
+{
+    std::unique_lock lock(mutex);
+    uint32_t* prev_write_slot = nullptr;
+    if(framebuffer_slots.size() != 0)
+        prev_write_slot = framebuffer_slots[frames.get_write_slot()];
+
+    framebuffer_slots = slots;
+    if(framebuffer_slots.size() == 0)
     {
-        age_framebuffer();
-        return faded_framebuffer.data();
+        for(size_t i = 0; i < 3; ++i)
+            framebuffer_slots.push_back(&internal_framebuffers[i*160*144]);
     }
-    return drive_framebuffer.data();
+
+    frames.reset(framebuffer_slots.size());
+    slot_timestamps.assign(framebuffer_slots.size(), total_ticks);
+    slot_line_hashes.assign(framebuffer_slots.size()*144, 0);
+    read_slot = framebuffer_slots.size()-1;
+
+    // Keep the partially drawn frame.
+    uint32_t* write_slot = framebuffer_slots[frames.get_write_slot()];
+    if(prev_write_slot)
+        memcpy(write_slot, prev_write_slot, sizeof(uint32_t)*160*144);
+    if(powered)
+        GB_set_pixels_output(&gb, write_slot);
+}
+
+void emulator::unset_framebuffer_slots(const std::vector<uint32_t*>& slots)
+{
+    std::unique_lock lock(mutex);
+    if(framebuffer_slots == slots)
+        set_framebuffer_slots({});
+}
+
+int emulator::acquire_framebuffer_slot(unsigned release_slot)
+{
+    return frames.acquire(release_slot);
+}
+
+uint64_t emulator::get_framebuffer_slot_timestamp(unsigned slot) const
+{
+    return slot_timestamps[slot];
 }
 
-void emulator::unlock_framebuffer()
+const uint64_t* emulator::get_framebuffer_slot_line_hashes(unsigned slot) const
 {
-    mutex.unlock();
+    return &slot_line_hashes[slot*144];
+}
+
+uint64_t emulator::get_emulated_ticks() const
+{
+    return published_ticks.load(std::memory_order_relaxed);
 }
 
 void emulator::worker_func()
 {
-    auto start = std::chrono::high_resolution_clock::now();
-    auto delta = start-start;
-    uint64_t surplus_time = 0;
-    uint64_t surplus_ticks = 0;
-    uint64_t delta_us = 0;
-    auto target_delta = std::chrono::microseconds(1000);
-    while(true)
+    // Emulation follows the host clock in short slices: each one emulates
+    // the host time that passed since the previous one. The audio device's
+    // clock never quite matches the host's, so the audio rate is steered to
+    // keep the buffer at its target level instead.
+    timed_lockable lockable(mutex, profile_lock_wait_time);
+    std::unique_lock lock(lockable);
+    while(!destroy)
     {
+        if(!powered || paused || rom.empty())
         {
-            std::unique_lock lock(mutex);
-            if(destroy)
-                break;
+            set_link_running(false);
+            wake.wait(lock);
+            pace_time = std::chrono::steady_clock::now();
+            continue;
+        }
 
-            auto end = std::chrono::high_resolution_clock::now();
-            delta = end - start;
-            delta_us = std::chrono::round<std::chrono::microseconds>(delta).count();
-            start = end;
+        if(rewinding)
+        {
+            rewind_step();
+            // The inputs are still taken in, so that nothing is left
+            // waiting in the queue when rewinding stops.
+            apply_inputs(true);
+            published_ticks.store(total_ticks, std::memory_order_relaxed);
+            wake.wait_for(lock, REWIND_STEP_INTERVAL);
+            pace_time = std::chrono::steady_clock::now();
+            continue;
+        }
 
-            uint64_t time = surplus_time + delta_us*TICKS_PER_SECOND;
+        auto work_start = std::chrono::steady_clock::now();
+        double elapsed = std::min(
+            std::chrono::duration<double>(work_start - pace_time).count(),
+            MAX_PACE_STEP
+        );
+        slice_start_time = pace_time;
+        slice_start_ticks = total_ticks;
+        pace_time = work_start;
 
-            uint64_t ticks_to_simulate = time/1000000;
-            surplus_time = time%1000000;
+        // The amount of ticks is known up front, so there's no need to keep
+        // checking the clock while emulating.
+        uint64_t slice_ticks = TURBO_SLICE_TICKS;
+        uint64_t refill_ticks = 0;
+        if(turbo_speed != 0)
+        {
+            pace_ticks += int64_t(elapsed * TICKS_PER_SECOND * turbo_speed);
+            pace_ticks = std::min(
+                pace_ticks, int64_t(MAX_PACE_STEP * TICKS_PER_SECOND * turbo_speed)
+            );
+            slice_ticks = std::max(pace_ticks, int64_t(0));
 
-            if(surplus_ticks >= ticks_to_simulate)
+            // After starting, unpausing or an underrun, the buffer is refilled
+            // right away instead of waiting for rate control to get there.
+            size_t fill = audio_output.get_unread_sample_count();
+            size_t target = audio_output.get_target_fill();
+            if(fill < target/4)
             {
-                surplus_ticks -= ticks_to_simulate;
+                refill_ticks = (target - fill) * TICKS_PER_SECOND / apu_samplerate;
+                slice_ticks += refill_ticks;
+                smoothed_fill = target;
             }
-            else
+        }
+
+        bool immediate_inputs = turbo_speed == 0;
+        uint64_t ticks = 0;
+        uint64_t run_calls = 0;
+        set_link_running(true);
+        while(ticks < slice_ticks)
+        {
+            apply_inputs(immediate_inputs);
+            sync_link();
+            uint8_t step = GB_run(&gb);
+            ticks += step;
+            total_ticks += step;
+            run_calls++;
+            if(vblank_occurred)
             {
-                ticks_to_simulate -= surplus_ticks;
-                surplus_ticks = 0;
-
-                if(this->powered && rom.size())
-                {
-                    int status = audio_output.get_sample_status();
-
-                    int clock_check_counter = 0;
-                    while(status <= 0 && (ticks_to_simulate > 0 || status < 0))
-                    {
-                        uint8_t ticks = GB_run(&gb);
-                        age_ticks += ticks;
-                        if(ticks < ticks_to_simulate)
-                        {
-                            ticks_to_simulate -= ticks;
-                        }
-                        if(ticks >= ticks_to_simulate)
-                        {
-                            surplus_ticks = ticks - ticks_to_simulate;
-                            ticks_to_simulate = 0;
-                        }
-                        status = audio_output.get_sample_status();
-                        if(++clock_check_counter > 64)
-                        {
-                            if(std::chrono::high_resolution_clock::now() - start > target_delta)
-                                break;
-                            clock_check_counter = 0;
-                        }
-                    }
-                }
-                else
-                {
-                    age_ticks += ticks_to_simulate;
-                }
+                auto vblank_start = std::chrono::steady_clock::now();
+                vblank_occurred = false;
+                capture_rewind();
+                if(use_run_ahead()) run_ahead();
+                prev_vblank_ticks = total_ticks;
+                profile_vblank_time +=
+                    std::chrono::steady_clock::now() - vblank_start;
             }
         }
+        flush_audio();
+        published_ticks.store(total_ticks, std::memory_order_relaxed);
+        profile_slice_time += std::chrono::steady_clock::now() - work_start;
+        if(link) profile_link_wait_time += link->take_wait_time(link_side);
+        profile_run_calls += run_calls;
+        profile_slices++;
+        update_profile();
+
+        if(turbo_speed == 0)
+        {
+            // Decimate audio by the speed we're actually running at.
+            double host_time = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - work_start
+            ).count();
+            double speed = ticks/(double)TICKS_PER_SECOND/host_time;
+            uint32_t samplerate = audio_output.get_samplerate();
+            set_apu_samplerate(clamp(
+                uint32_t(samplerate/speed), TURBO_MIN_SAMPLERATE, samplerate
+            ));
+
+            // Don't wait, but let others grab the lock in between.
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+            pace_ticks = 0;
+            continue;
+        }
+
+        // The refill is extra, it doesn't count against the host clock.
+        pace_ticks -= int64_t(ticks - refill_ticks);
+        update_rate_control(elapsed);
+
+        // Anything that could stop emulation notifies early. Spurious
+        // wakeups just cause a short slice.
+        wake.wait_for(
+            lock, audio_output.get_buffer_duration() / SLICES_PER_BUFFER
+        );
+    }
+}
+
+void emulator::update_rate_control(double elapsed)
+{
+    // The fill level jumps down by a buffer length on every pull of the
+    // backend, so it's smoothed before use. Then, the audio rate is nudged
+    // in proportion to the distance from the target.
+    double fill = audio_output.get_unread_sample_count();
+    double target = audio_output.get_target_fill();
+    smoothed_fill += (fill - smoothed_fill) *
+        (1.0 - std::exp(-elapsed / FILL_SMOOTHING_TIME));
+    double error = clamp((target - smoothed_fill) / target, -1.0, 1.0);
+    rate_ratio = 1.0 + MAX_RATE_ADJUSTMENT * error;
+    set_apu_samplerate(uint32_t(std::round(base_samplerate * rate_ratio)));
+}
+
+void emulator::apply_inputs(bool immediate)
+{
+    if(movie_playing)
+    {
+        uint64_t ticks = total_ticks - movie_start_ticks;
+        while(
+            movie_cursor < movie.events.size() &&
+            movie.events[movie_cursor].ticks <= ticks
+        ){
+            const input_movie::event& e = movie.events[movie_cursor++];
+            set_core_button((GB_key_t)e.button, e.pressed);
+        }
+
+        input_event ignored;
+        while(inputs.pop(ignored));
+        has_next_input = false;
+        inputs_overflowed = false;
+
+        if(ticks >= movie.length_ticks)
+        {
+            printf("Movie %s finished\n", movie_path.c_str());
+            end_movie();
+        }
+        return;
+    }
+
+    // After an overflow, the timing of the changes is lost anyway.
+    bool overflowed = inputs_overflowed.exchange(false);
+    if(overflowed) immediate = true;
+
+    while(true)
+    {
+        if(!has_next_input)
+        {
+            if(!inputs.pop(next_input))
+                break;
+            has_next_input = true;
+
+            // Each slice emulates the host time since the previous one, so
+            // inputs from that time land in it, delayed by a slice. This
+            // keeps their relative timing intact down to the cycle.
+            double offset = std::chrono::duration<double>(
+                next_input.time - slice_start_time
+            ).count() * std::max(turbo_speed, 1u);
+            next_input_ticks = std::max(
+                int64_t(slice_start_ticks) + int64_t(offset * TICKS_PER_SECOND),
+                int64_t(0)
+            );
+        }
+
+        if(!immediate && total_ticks < next_input_ticks)
+            return;
+
+        apply_input(next_input.button, next_input.pressed);
+        has_next_input = false;
+    }
+
+    if(overflowed)
+    {
+        for(unsigned i = 0; i < 8; ++i)
+        {
+            if(button_states[i] != core_button_states[i])
+                apply_input(GB_key_t(GB_KEY_RIGHT+i), button_states[i]);
+        }
+    }
+}
+
+void emulator::apply_input(GB_key_t button, bool pressed)
+{
+    if(!powered)
+        return;
+
+    set_core_button(button, pressed);
+    if(movie_recording)
+    {
+        movie.events.push_back({
+            total_ticks - movie_start_ticks, (uint8_t)button, pressed
+        });
+    }
+}
+
+void emulator::update_profile()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto window = now - profile_window_start;
+    if(window < PROFILE_WINDOW)
+        return;
+
+    // The slice time includes everything, so the rest is what's left over
+    // from the callbacks and the frame work.
+    auto run_time = profile_slice_time - profile_vblank_time -
+        profile_audio_time - profile_link_wait_time;
+    published_run_time = per_second(run_time, window);
+    published_vblank_time = per_second(profile_vblank_time, window);
+    published_audio_time = per_second(profile_audio_time, window);
+    published_lock_wait_time = per_second(profile_lock_wait_time, window);
+    published_link_wait_time = per_second(profile_link_wait_time, window);
+    published_run_calls_per_slice = profile_slices == 0 ? 0.0 :
+        profile_run_calls / double(profile_slices);
+    published_slices_per_second =
+        profile_slices / std::chrono::duration<double>(window).count();
+    published_audio_buffered = smoothed_fill / audio_output.get_samplerate();
+    published_audio_latency = published_audio_buffered + (
+        a ? a->get_buffer_size() / double(a->get_samplerate()) : 0.0
+    );
+    published_audio_rate_ratio = rate_ratio;
+
+    profile_window_start = now;
+    profile_slice_time = profile_slice_time.zero();
+    profile_vblank_time = profile_vblank_time.zero();
+    profile_audio_time = profile_audio_time.zero();
+    profile_lock_wait_time = profile_lock_wait_time.zero();
+    profile_link_wait_time = profile_link_wait_time.zero();
+    profile_run_calls = 0;
+    profile_slices = 0;
+}
+
+void emulator::set_core_button(GB_key_t button, bool pressed)
+{
+    GB_set_key_state(&gb, button, pressed);
+    core_button_states[button-GB_KEY_RIGHT] = pressed;
+}
+
+bool emulator::use_run_ahead() const
+{
+    return !headless && run_ahead_frames > 0 && run_ahead_active &&
+        turbo_speed == 1 && !rewinding && !link;
+}
+
+void emulator::run_ahead()
+{
+    auto start = std::chrono::steady_clock::now();
 
-        auto local_end = std::chrono::high_resolution_clock::now();
-        auto local_delta = local_end - start;
-        if(local_delta < target_delta)
+    // The size only changes with the ROM, so this doesn't allocate during
+    // normal play.
+    size_t state_size = GB_get_save_state_size(&gb);
+    if(run_ahead_state.size() != state_size)
+        run_ahead_state.resize(state_size);
+    GB_save_state_to_buffer(&gb, run_ahead_state.data());
+
+    // Only the last frame needs to be drawn, and none of the audio is heard.
+    in_run_ahead = true;
+    run_ahead_remaining = run_ahead_frames;
+    GB_set_rendering_disabled(&gb, run_ahead_remaining > 1);
+    while(run_ahead_remaining > 0)
+        GB_run(&gb);
+    in_run_ahead = false;
+
+    if(GB_load_state_from_buffer(&gb, run_ahead_state.data(), state_size) != 0)
+    {
+        printf("Run-ahead failed to roll back, disabling it\n");
+        run_ahead_active = false;
+        return;
+    }
+    run_ahead_presented_frames++;
+
+    // Running ahead by N frames costs about as much as emulating N real
+    // frames, so the real frame adds roughly 1/N on top of that.
+    run_ahead_window_time += std::chrono::steady_clock::now() - start;
+    run_ahead_window_ticks += total_ticks - prev_vblank_ticks;
+    if(++run_ahead_window_frames >= RUN_AHEAD_WINDOW)
+    {
+        double host_time = std::chrono::duration<double>(
+            run_ahead_window_time
+        ).count() * (run_ahead_frames+1) / run_ahead_frames;
+        double real_time = run_ahead_window_ticks/(double)TICKS_PER_SECOND;
+        if(host_time > real_time * RUN_AHEAD_BUDGET)
         {
-            // Aim to spend a millisecond each loop.
-            std::this_thread::sleep_for(target_delta-local_delta);
+            printf(
+                "Run-ahead took %.1f ms per %.1f ms of real time, disabling it\n",
+                host_time*1e3, real_time*1e3
+            );
+            run_ahead_active = false;
         }
+        run_ahead_window_ticks = 0;
+        run_ahead_window_time = run_ahead_window_time.zero();
+        run_ahead_window_frames = 0;
     }
 }
 
+void emulator::capture_rewind()
+{
+    if(!rewind_history || ++frames_since_capture < REWIND_INTERVAL)
+        return;
+
+    // If the compressor is lagging behind, this state is just skipped.
+    uint8_t* state = rewind_history->begin_capture();
+    if(!state) return;
+    GB_save_state_to_buffer(&gb, state);
+    rewind_history->end_capture();
+    frames_since_capture = 0;
+}
+
+void emulator::rewind_step()
+{
+    if(!rewind_history->step_back(rewind_state.data()))
+        return;
+
+    int err = GB_load_state_from_buffer(
+        &gb, rewind_state.data(), rewind_state.size()
+    );
+    if(err != 0) return;
+
+    if(frame_hidden)
+    {
+        frame_hidden = false;
+        GB_set_rendering_disabled(&gb, false);
+    }
+
+    // Run for a frame to have something to show.
+    uint64_t target_frame = frame_count + 1;
+    while(frame_count < target_frame)
+        total_ticks += GB_run(&gb);
+    vblank_occurred = false;
+}
+
+void emulator::publish_frame()
+{
+    unsigned slot = frames.get_write_slot();
+    slot_timestamps[slot] = total_ticks;
+    const uint32_t* pixels = framebuffer_slots[slot];
+    for(unsigned y = 0; y < 144; ++y, pixels += 160)
+    {
+        // FNV-1a on whole pixels, this runs every frame.
+        uint64_t hash = 0xcbf29ce484222325;
+        for(unsigned x = 0; x < 160; ++x)
+            hash = (hash ^ pixels[x]) * 0x100000001b3;
+        slot_line_hashes[slot*144+y] = hash;
+    }
+    frames.publish();
+    GB_set_pixels_output(&gb, framebuffer_slots[frames.get_write_slot()]);
+}
+
+void emulator::set_apu_samplerate(uint32_t samplerate)
+{
+    if(apu_samplerate == samplerate)
+        return;
+    apu_samplerate = samplerate;
+    if(powered) GB_set_sample_rate(&gb, apu_samplerate);
+}
+
 void emulator::init_gb()
 {
     GB_init(&gb, GB_MODEL_CGB_E);
@@ -319,7 +1145,7 @@ void emulator::init_gb()
 
     GB_load_boot_rom(&gb, get_readonly_path("data/cgb_boot.bin").c_str());
     GB_set_vblank_callback(&gb, handle_vblank);
-    GB_set_pixels_output(&gb, active_framebuffer.data());
+    GB_set_pixels_output(&gb, framebuffer_slots[frames.get_write_slot()]);
     GB_set_rgb_encode_callback(&gb, rgb_encode);
     GB_set_rumble_mode(&gb, GB_RUMBLE_DISABLED);
     GB_set_color_correction_mode(&gb, GB_COLOR_CORRECTION_DISABLED);
@@ -327,71 +1153,190 @@ void emulator::init_gb()
     GB_set_palette(&gb, &GB_PALETTE_GREY);
     GB_set_log_callback(&gb, log_callback);
 
-    GB_set_sample_rate(&gb, 48000);
-    GB_set_interference_volume(&gb, 1.0f);
-    GB_set_highpass_filter_mode(&gb, GB_HIGHPASS_ACCURATE);
+    GB_set_sample_rate(&gb, apu_samplerate);
+    GB_set_interference_volume(&gb, audio_interference ? 1.0f : 0.0f);
+    GB_set_highpass_filter_mode(
+        &gb, audio_highpass ? GB_HIGHPASS_ACCURATE : GB_HIGHPASS_OFF
+    );
 
-    GB_set_rtc_mode(&gb, GB_RTC_MODE_SYNC_TO_HOST);
+    set_rtc_mode();
     GB_apu_set_sample_callback(&gb, push_audio_sample);
+    set_link_callbacks();
 
+    frame_hidden = false;
+    for(bool& state: core_button_states) state = false;
     powered = true;
 }
 
+void emulator::set_rtc_mode()
+{
+    // Headless runs and movies should be repeatable, so the RTC must not
+    // follow the host clock there.
+    GB_set_rtc_mode(
+        &gb,
+        headless || movie_recording || movie_playing ?
+            GB_RTC_MODE_ACCURATE : GB_RTC_MODE_SYNC_TO_HOST
+    );
+}
+
+uint64_t emulator::get_rom_hash()
+{
+    size_t size = 0;
+    void* data = GB_get_direct_access(&gb, GB_DIRECT_ACCESS_ROM, &size, nullptr);
+    return fnv1a(data, size);
+}
+
+void emulator::mark_sav_clean()
+{
+    size_t ram_size = 0;
+    uint8_t* ram = (uint8_t*)GB_get_direct_access(
+        &gb, GB_DIRECT_ACCESS_CART_RAM, &ram_size, nullptr
+    );
+    saved_cart_ram.assign(ram, ram + ram_size);
+    sav_generation = 0;
+}
+
+void emulator::connect_link(link_cable* cable, unsigned side)
+{
+    std::unique_lock lock(mutex);
+    link = cable;
+    link_side = side;
+    link_running = false;
+    if(powered) set_link_callbacks();
+}
+
+void emulator::disconnect_link()
+{
+    std::unique_lock lock(mutex);
+    link = nullptr;
+    link_running = false;
+    if(powered) set_link_callbacks();
+}
+
+void emulator::set_link_callbacks()
+{
+    GB_set_serial_transfer_bit_start_callback(
+        &gb, link ? serial_bit_start : nullptr
+    );
+    GB_set_serial_transfer_bit_end_callback(
+        &gb, link ? serial_bit_end : nullptr
+    );
+}
+
+void emulator::sync_link()
+{
+    if(!link) return;
+
+    uint8_t* io = (uint8_t*)GB_get_direct_access(
+        &gb, GB_DIRECT_ACCESS_IO, nullptr, nullptr
+    );
+    link->sync(link_side, total_ticks, io[GB_IO_SB]);
+
+    // SameBoy ignores these if this side is clocking the transfer itself.
+    bool bit;
+    while(link->receive(link_side, total_ticks, bit))
+        GB_serial_set_data_bit(&gb, bit);
+}
+
+void emulator::set_link_running(bool running)
+{
+    if(!link || link_running == running)
+        return;
+    link->set_running(link_side, total_ticks, running);
+    link_running = running;
+}
+
 void emulator::deinit_gb()
 {
+    end_movie();
     GB_free(&gb);
     powered = false;
     sav = "";
 }
 
-void emulator::age_framebuffer()
+void emulator::flush_audio()
 {
-    float age = float(age_ticks)/float(TICKS_PER_SECOND);
-
-    vec3 up_mix_ratio = pow(vec3(0.5), age/vec3(0.0052, 0.0042, 0.0028));
-    vec3 down_mix_ratio = pow(vec3(0.5), age/vec3(0.0076, 0.0076, 0.006));
+    if(audio_block_size == 0)
+        return;
 
-    for(unsigned i = 0; i < 160 * 144; ++i)
+    // Hashing the block at once gives the same result as sample by sample.
+    if(headless)
     {
-        vec4 prev = prev_faded_framebuffer[i];
-        vec4 drive = drive_framebuffer[i];
-
-        vec3 ratio = down_mix_ratio;
-        if(drive.r > prev.r) ratio.r = up_mix_ratio.r;
-        if(drive.g > prev.g) ratio.g = up_mix_ratio.g;
-        if(drive.b > prev.b) ratio.b = up_mix_ratio.b;
-
-        // I don't understand why, but using SSE makes this particular thing
-        // like 10 times slower than breaking it up like this. Maybe it breaks
-        // some compiler optimizations here?
-        faded_framebuffer[i].r = mix(drive.r, prev.r, ratio.r);
-        faded_framebuffer[i].g = mix(drive.g, prev.g, ratio.g);
-        faded_framebuffer[i].b = mix(drive.b, prev.b, ratio.b);
-        faded_framebuffer[i].a = 1.0f;
+        audio_hash = fnv1a(
+            audio_block.data(), audio_block_size*sizeof(GB_sample_t),
+            audio_hash
+        );
+        if(audio_dump)
+        {
+            audio_dump->write(
+                (const int16_t*)audio_block.data(), audio_block_size
+            );
+        }
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        audio_output.push_samples(audio_block.data(), audio_block_size);
+        profile_audio_time += std::chrono::steady_clock::now() - start;
     }
+    audio_block_size = 0;
 }
 
 void emulator::push_audio_sample(GB_gameboy_t *gb, GB_sample_t* sample)
 {
+    // This is called for every sample, so it only stores it.
     emulator& self = *(emulator*)GB_get_user_data(gb);
-    self.audio_output.push_sample(sample);
+    if(self.in_run_ahead || self.rewinding) return;
+    self.audio_block[self.audio_block_size++] = *sample;
+    if(self.audio_block_size == self.audio_block.size())
+        self.flush_audio();
 }
 
-void emulator::handle_vblank(GB_gameboy_t *gb)
+void emulator::serial_bit_start(GB_gameboy_t *gb, bool bit)
 {
     emulator& self = *(emulator*)GB_get_user_data(gb);
+    if(self.link)
+        self.link->send_clocked_bit(self.link_side, self.total_ticks, bit);
+}
 
-    if(self.fade_enabled)
+bool emulator::serial_bit_end(GB_gameboy_t *gb)
+{
+    emulator& self = *(emulator*)GB_get_user_data(gb);
+    return self.link ? self.link->receive_clocked_bit(self.link_side) : true;
+}
+
+void emulator::handle_vblank(GB_gameboy_t *gb)
+{
+    emulator& self = *(emulator*)GB_get_user_data(gb);
+    if(self.in_run_ahead)
     {
-        self.age_framebuffer();
-        memcpy(
-            self.prev_faded_framebuffer.data(),
-            self.faded_framebuffer.data(),
-            self.faded_framebuffer.size()*sizeof(vec4)
-        );
+        if(self.run_ahead_remaining == 0) return;
+        self.run_ahead_remaining--;
+        if(self.run_ahead_remaining == 1)
+            GB_set_rendering_disabled(gb, false);
+        else if(self.run_ahead_remaining == 0)
+            self.publish_frame();
+        return;
     }
-    self.age_ticks = 0;
 
-    for(unsigned i = 0; i < 160 * 144; ++i)
-        self.drive_framebuffer[i] = unpackUnorm4x8(self.active_framebuffer[i]);
+    // Run-ahead is timed as a whole by the worker.
+    auto start = std::chrono::steady_clock::now();
+    self.frame_count++;
+    self.vblank_occurred = true;
+    if(self.turbo_speed != 1 && !self.rewinding)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(!self.frame_hidden)
+        {
+            self.publish_frame();
+            self.last_shown_frame = now;
+        }
+        // Decide if the next frame is going to be shown.
+        self.frame_hidden = now - self.last_shown_frame < TURBO_FRAME_INTERVAL;
+        GB_set_rendering_disabled(gb, self.frame_hidden);
+    }
+    // With run-ahead, the frame from the future is published instead.
+    else if(!self.use_run_ahead())
+        self.publish_frame();
+    self.profile_vblank_time += std::chrono::steady_clock::now() - start;
 }
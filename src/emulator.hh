@@ -5,27 +5,47 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include "math.hh"
 #include "audio.hh"
+#include "frame_mailbox.hh"
+#include "rewind_buffer.hh"
+#include "spsc_queue.hh"
+#include "input_movie.hh"
+#include "save_writer.hh"
+#include "wav_writer.hh"
+#define TICKS_PER_SECOND 0x800000
 extern "C"
 {
 #include "gb.h"
 #undef internal
 }
 
+class link_cable;
 class emulator_audio: public SoLoud::AudioSource
 {
 public:
     emulator_audio(uint32_t buffer_length, uint32_t samplerate);
     ~emulator_audio();
 
-    void push_sample(GB_sample_t* sample);
+    // Only while the source isn't playing. The buffer length should be the
+    // amount the backend takes at a time.
+    void set_format(uint32_t buffer_length, uint32_t samplerate);
 
-    // -1: danger of underflowing soon, emulate enough samples ASAP
-    // 0: all is well
-    // 1: danger of overflowing soon, don't emulate more samples
-    int get_sample_status() const;
+    void push_samples(const GB_sample_t* samples, size_t count);
+
+    uint32_t get_samplerate() const;
+    size_t get_unread_sample_count() const;
+    // The emulator aims to keep the buffer at this fill level on average.
+    // SoLoud takes a whole buffer length at a time, so the level drops in
+    // steps and climbs back up in between; one buffer length on average
+    // leaves half a buffer of headroom for the emulator's slices.
+    size_t get_target_fill() const;
+    // Duration of one buffer length of samples.
+    std::chrono::microseconds get_buffer_duration() const;
 
     SoLoud::AudioSourceInstance* createInstance() override;
 
@@ -37,58 +57,356 @@ private:
 class emulator
 {
 public:
+    // Where the emulating thread spent its host time during the latest
+    // profiling window, in seconds per second.
+    struct profile
+    {
+        // GB_run(), i.e. the CPU, PPU and APU, excluding the callbacks below.
+        // Includes the small amount of bookkeeping between the calls.
+        double run_time;
+        // The vblank callback and the per-frame work done after it, like
+        // rewind captures and run-ahead.
+        double vblank_time;
+        // Handing blocks of samples over to the audio output.
+        double audio_time;
+        // Waiting to lock the emulator mutex held by other threads.
+        double lock_wait_time;
+        // Waiting for the other emulator to catch up over the link cable.
+        double link_wait_time;
+        double run_calls_per_slice;
+        double slices_per_second;
+        // Average amount of audio buffered in the emulator, in seconds, and
+        // the current adjustment of the audio rate to keep it on target.
+        double audio_buffered;
+        double audio_rate_ratio;
+        // Average time from the emulator generating a sample to it leaving
+        // the backend: the buffered audio plus the backend's buffer.
+        double audio_latency;
+        // The rate the audio device actually opened at, 0 if there is none.
+        uint32_t audio_device_samplerate;
+    };
+
+    // The default constructor creates a headless emulator: there is no audio
+    // output and no worker thread, emulation only advances via run_frames().
+    emulator();
     emulator(audio& a);
     ~emulator();
 
     void set_audio_mode(transformable* positional = nullptr);
+    // Matches the audio output to the current format of the audio context.
+    // Call after audio::set_format(), the source is added back here.
+    void reset_audio_output();
 
     void reset();
     bool load_rom(const std::string& path);
     void load_sav(const std::string& path);
+    // Only saves if the cartridge RAM has changed since the last save or
+    // load. The file is written in the background.
     void save_sav();
     void set_power(bool on);
 
+    // Button changes are queued with the current host time and applied at
+    // the corresponding emulated cycle, so they never wait for emulation.
+    // Must only be called from one thread.
     void set_button(GB_key_t button, bool pressed);
     bool get_button(GB_key_t button);
     void print_info();
 
+    // Runs the emulator as fast as possible until the given number of frames
+    // has been emulated. Returns the number of emulated ticks. Only meant for
+    // headless emulators, the worker thread of a real-time one would compete
+    // with it.
+    uint64_t run_frames(unsigned count);
+    uint64_t get_frame_count() const;
+    // Headless emulators have no audio output, they just hash the samples
+    // they generate for regression testing.
+    uint64_t get_audio_hash() const;
+    // Reads emulated memory without side effects, so that test ROMs can
+    // leave their results in RAM for the caller to check.
+    uint8_t read_memory(uint16_t address);
+    // Headless emulators can also write the audio they generate into a WAV
+    // file, at the sample rate of the APU. The file is finished by
+    // stop_audio_dump() or destroying the emulator. Stopping returns false
+    // if writing the file failed.
+    bool start_audio_dump(const std::string& path);
+    bool stop_audio_dump();
+    // The high-pass filter and the interference from the rest of the
+    // console are emulated by default. Takes effect on the next power-on.
+    void set_audio_filters(bool highpass, bool interference);
+
+    // Run-ahead hides the input lag of games that poll input late: after
+    // each frame, the emulator runs this many frames further with the current
+    // inputs, presents the last one and rolls back. 0 disables it. It turns
+    // itself off if the host can't run (frames+1) times faster than real
+    // time; setting it again re-enables it.
+    void set_run_ahead(unsigned frames);
+    unsigned get_run_ahead() const;
+    // Returns false if run-ahead was turned off due to lack of speed.
+    bool is_run_ahead_active() const;
+
+    // Fast-forward. 1 is normal speed, N runs at N times real time and 0 is
+    // uncapped. While fast-forwarding, the audio is decimated to keep up and
+    // frames are only drawn often enough for the display, hidden ones skip
+    // pixel output entirely. Run-ahead is inactive during turbo.
+    void set_turbo(unsigned speed);
+    unsigned get_turbo() const;
+
+    // While rewinding, the emulator steps backwards through its recent
+    // history instead of running forwards. Only available for real-time
+    // emulators that aren't linked.
+    void set_rewinding(bool rewinding);
+    bool is_rewinding() const;
+
+    // Recording captures the current state and every following button
+    // change. Playback restores the recorded state and replays the changes
+    // at the exact same cycles, ignoring live input until the movie ends.
+    // The RTC runs in emulated time during both, so that it doesn't depend
+    // on the host clock.
+    bool start_recording(const std::string& path);
+    bool play_movie(const std::string& path);
+    // Stops recording or playback. A recording is written to disk in the
+    // background; this waits for it without holding up emulation, and
+    // returns false if the file couldn't be written.
+    bool stop_movie();
+    bool is_recording_movie() const;
+    bool is_playing_movie() const;
+
+    // A paused emulator doesn't advance at all. The worker thread sleeps
+    // until it's unpaused.
+    void set_paused(bool paused);
+    bool is_paused() const;
+
+    void dump_timing() const;
+    // Can be called from any thread; it never blocks the emulator. Only
+    // real-time emulators are profiled.
+    profile get_profile() const;
+
     static uvec2 get_screen_size();
 
+    // The LCD pixel transitions are applied by the renderer, the emulator
+    // only stores the setting.
     void set_framebuffer_fade(bool enable);
+    bool get_framebuffer_fade() const;
+
+    // Returns the latest completed frame. Must only be called from one
+    // thread, usually the renderer. It never blocks on emulation; the
+    // returned data stays valid until the next call. Pixels are 32-bit, with
+    // the native 15-bit color of the GBC in the lowest bits (red first).
+    const uint32_t* get_framebuffer_data();
+    // Emulated ticks at the start of the frame returned by the latest
+    // get_framebuffer_data() call.
+    uint64_t get_framebuffer_timestamp() const;
 
-    void lock_framebuffer();
-    const vec4* get_framebuffer_data();
-    void unlock_framebuffer();
+    // Zero-copy frame output: the emulator renders straight into the given
+    // slots, each of which holds 160x144 pixels in the get_framebuffer_data()
+    // format. At least three slots are needed. Ownership of the slots is
+    // handed back and forth as described in frame_mailbox; the caller owns
+    // slots 2 and up at first, and must then read frames only through
+    // acquire_framebuffer_slot() instead of get_framebuffer_data(). The slots
+    // must stay valid until unset_framebuffer_slots() is called with them.
+    void set_framebuffer_slots(const std::vector<uint32_t*>& slots);
+    // Returns to internal framebuffer memory, unless different slots have
+    // been set since.
+    void unset_framebuffer_slots(const std::vector<uint32_t*>& slots);
+    int acquire_framebuffer_slot(unsigned release_slot);
+    uint64_t get_framebuffer_slot_timestamp(unsigned slot) const;
+    // Hash of each scanline of the frame in the slot. Comparing these tells
+    // which lines differ between two frames.
+    const uint64_t* get_framebuffer_slot_line_hashes(unsigned slot) const;
+    // Total emulated ticks so far. Updated after every emulated slice, so it
+    // may lag slightly behind the emulating thread.
+    uint64_t get_emulated_ticks() const;
 
 private:
+    friend class link_cable;
+
+    struct input_event
+    {
+        std::chrono::steady_clock::time_point time;
+        GB_key_t button;
+        bool pressed;
+    };
+
     void worker_func();
+    // Applies queued inputs that are due by now, or all of them if
+    // immediate is set.
+    void apply_inputs(bool immediate);
+    void set_core_button(GB_key_t button, bool pressed);
+    // Applies a live input to the core and records it into the movie.
+    void apply_input(GB_key_t button, bool pressed);
+    // Stops the movie without waiting for the file, for use with the lock
+    // held. Returns the save_writer generation of the file, or 0.
+    uint64_t end_movie();
+    bool use_run_ahead() const;
+    void run_ahead();
+    void publish_frame();
+    void set_apu_samplerate(uint32_t samplerate);
+    void update_rate_control(double elapsed);
+    void capture_rewind();
+    uint64_t get_rom_hash();
+    void mark_sav_clean();
+    void set_rtc_mode();
+    void rewind_step();
+    // Only used by link_cable.
+    void connect_link(link_cable* cable, unsigned side);
+    void disconnect_link();
+    void set_link_callbacks();
+    // Exchanges bits with the other side and keeps the skew in check, called
+    // before every step while linked.
+    void sync_link();
+    void set_link_running(bool running);
+    void update_profile();
+    // Hands the collected audio samples over to the output, or the hash and
+    // dump for headless emulators.
+    void flush_audio();
 
     void init_gb();
     void deinit_gb();
 
-    void age_framebuffer();
-
     static void push_audio_sample(GB_gameboy_t *gb, GB_sample_t* sample);
     static void handle_vblank(GB_gameboy_t *gb);
+    static void serial_bit_start(GB_gameboy_t *gb, bool bit);
+    static bool serial_bit_end(GB_gameboy_t *gb);
 
-    uint64_t age_ticks;
+    uint64_t total_ticks;
+    std::atomic_uint64_t published_ticks;
+    uint64_t frame_count;
+    uint64_t audio_hash;
+    // Samples from SameBoy are collected here and passed on in blocks.
+    std::vector<GB_sample_t> audio_block;
+    size_t audio_block_size;
+    std::unique_ptr<wav_writer> audio_dump;
+    bool audio_highpass;
+    bool audio_interference;
     bool powered;
+    bool paused;
     bool destroy;
-    bool fade_enabled;
+    std::atomic_bool fade_enabled;
     GB_gameboy_t gb;
     audio* a;
     std::string rom, sav;
+    // Cartridge RAM contents as of the last save or load.
+    std::vector<uint8_t> saved_cart_ram;
+    // Created on the first save.
+    std::unique_ptr<save_writer> sav_writer;
+    // Generation of the latest write of the save, 0 if there has been none
+    // since it was loaded. If it fails, the save is written again even
+    // though the RAM hasn't changed since.
+    uint64_t sav_generation;
+    std::unique_ptr<save_writer> movie_writer;
     emulator_audio audio_output;
     SoLoud::handle audio_handle;
-    std::vector<uint32_t> active_framebuffer;
-    std::vector<vec4> drive_framebuffer;
-    std::vector<vec4> faded_framebuffer;
-    std::vector<vec4> prev_faded_framebuffer;
+    transformable* audio_positional;
+    bool headless;
+    // Completed frames, published by handle_vblank(). SameBoy draws
+    // directly into the write slot.
+    frame_mailbox frames;
+    std::vector<uint32_t*> framebuffer_slots;
+    // Emulated ticks at the start of the frame in each slot.
+    std::vector<uint64_t> slot_timestamps;
+    std::vector<uint64_t> slot_line_hashes;
+    // Used when no external slots are set.
+    std::vector<uint32_t> internal_framebuffers;
+    // Reader-owned slot for get_framebuffer_data().
+    unsigned read_slot;
+
+    unsigned run_ahead_frames;
+    // Frames left to emulate in the current run-ahead, 0 when not running
+    // ahead.
+    unsigned run_ahead_remaining;
+    bool in_run_ahead;
+    bool vblank_occurred;
+    std::atomic_bool run_ahead_active;
+    // Saved state to roll back to, sized once per ROM.
+    std::vector<uint8_t> run_ahead_state;
+    // Speed budget tracking over a window of real frames.
+    uint64_t prev_vblank_ticks;
+    uint64_t run_ahead_window_ticks;
+    std::chrono::steady_clock::duration run_ahead_window_time;
+    unsigned run_ahead_window_frames;
+    std::atomic_uint64_t run_ahead_presented_frames;
+
+    unsigned turbo_speed;
+    // Whether the frame currently being emulated is skipped.
+    bool frame_hidden;
+    std::chrono::steady_clock::time_point last_shown_frame;
+    uint32_t apu_samplerate;
+    // The APU rate before rate control, lower than the output rate during
+    // turbo.
+    uint32_t base_samplerate;
+
+    // Emulation follows the host clock, and the audio rate is adjusted
+    // slightly to keep the audio buffer at its target level.
+    std::chrono::steady_clock::time_point pace_time;
+    // Ticks owed to the host clock, negative if the previous slice overshot.
+    int64_t pace_ticks;
+    // Fill level of the audio buffer, smoothed over the pulls of the backend.
+    double smoothed_fill;
+    double rate_ratio;
+
+    // Null for headless emulators, they have no use for it.
+    std::unique_ptr<rewind_buffer> rewind_history;
+    std::vector<uint8_t> rewind_state;
+    bool rewinding;
+    unsigned frames_since_capture;
+
+    // Latest state of each button, written by the input thread.
+    std::atomic_bool button_states[8];
+    // The button states that have actually been applied to the core.
+    bool core_button_states[8];
+    spsc_queue<input_event> inputs;
+    // Set when an input didn't fit in the queue. The emulator then applies
+    // what's left in it right away and catches up with button_states, so
+    // that a dropped change (like a release) is never lost for good.
+    std::atomic_bool inputs_overflowed;
+    // The next input is taken out of the queue as soon as its emulated
+    // cycle is known.
+    bool has_next_input;
+    input_event next_input;
+    uint64_t next_input_ticks;
+    // Host time corresponding to the emulated ticks at the start of the
+    // current slice, used to map input times to emulated cycles.
+    std::chrono::steady_clock::time_point slice_start_time;
+    uint64_t slice_start_ticks;
+
+    bool movie_recording;
+    bool movie_playing;
+    input_movie movie;
+    std::string movie_path;
+    uint64_t movie_start_ticks;
+    size_t movie_cursor;
+
+    link_cable* link;
+    unsigned link_side;
+    bool link_running;
 
-    bool button_states[8];
+    // Profiling counters of the current window, only touched by the worker.
+    std::chrono::steady_clock::time_point profile_window_start;
+    std::chrono::steady_clock::duration profile_slice_time;
+    std::chrono::steady_clock::duration profile_vblank_time;
+    std::chrono::steady_clock::duration profile_audio_time;
+    std::chrono::steady_clock::duration profile_lock_wait_time;
+    std::chrono::steady_clock::duration profile_link_wait_time;
+    uint64_t profile_run_calls;
+    uint64_t profile_slices;
+    // Results of the latest complete window. The fields are published one
+    // by one, so a reader may see a mix of two consecutive windows.
+    std::atomic<double> published_run_time;
+    std::atomic<double> published_vblank_time;
+    std::atomic<double> published_audio_time;
+    std::atomic<double> published_lock_wait_time;
+    std::atomic<double> published_link_wait_time;
+    std::atomic<double> published_run_calls_per_slice;
+    std::atomic<double> published_slices_per_second;
+    std::atomic<double> published_audio_buffered;
+    std::atomic<double> published_audio_rate_ratio;
+    std::atomic<double> published_audio_latency;
+    std::atomic_uint32_t published_audio_device_samplerate;
 
     // Yeah, I'm lazy like that...
     std::recursive_mutex mutex;
+    // Notified whenever the worker may have to start or stop emulating.
+    std::condition_variable_any wake;
     std::thread worker;
 };
 
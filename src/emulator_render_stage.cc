@@ -1,7 +1,9 @@
 #include "emulator_render_stage.hh"
 #include "emulator_transform.comp.h"
+#include "emulator_fade.comp.h"
 #include "io.hh"
 #include "helpers.hh"
+#include <algorithm>
 
 namespace
 {
@@ -12,8 +14,37 @@ struct push_constants
     uint32_t use_color_mapping;
     uint32_t apply_gamma;
     int32_t mip_layer;
+    int32_t row_offset;
 };
 
+struct fade_parameters_buffer
+{
+    float prev_drive_time;
+    float drive_time;
+    uint32_t fade_enabled;
+    uint32_t slot;
+    uint32_t first_line;
+};
+
+// Emulated time after a change until the fade is considered converged. The
+// half-lives are below 10 ms, so this is well past any visible difference.
+constexpr uint64_t FADE_SETTLE_TICKS = TICKS_PER_SECOND/5;
+
+float ticks_to_seconds(uint64_t ticks)
+{
+    return float(ticks)/float(TICKS_PER_SECOND);
+}
+
+texture create_state_texture(context& ctx, uvec2 size)
+{
+    std::vector<vec4> white(size.x*size.y, vec4(1));
+    return texture(
+        ctx, size, VK_FORMAT_R32G32B32A32_SFLOAT,
+        white.size()*sizeof(vec4), white.data(),
+        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT
+    );
+}
+
 }
 
 emulator_render_stage::emulator_render_stage(
@@ -23,93 +54,305 @@ emulator_render_stage::emulator_render_stage(
     bool do_generate_mipmaps,
     bool color_mapping,
     bool apply_gamma
-):  render_stage(ctx), emu(&emu),
+):  render_stage(ctx), emu(&emu), target(target),
+    do_generate_mipmaps(do_generate_mipmaps),
+    color_mapping(color_mapping),
+    apply_gamma(apply_gamma),
+    mip_layer(0),
+    fade_pipeline(ctx),
     transform_pipeline(ctx),
-    image_buffer(
-        ctx,
-        sizeof(vec4)*emu.get_screen_size().x*emu.get_screen_size().y,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        false
-    ),
+    fade_parameters(ctx, sizeof(fade_parameters_buffer)),
+    drive_state(create_state_texture(ctx, emu.get_screen_size())),
+    fade_state(create_state_texture(ctx, emu.get_screen_size())),
+    prev_frame_timestamp(0),
+    prev_render_ticks(emu.get_emulated_ticks()),
+    force_full(true),
+    prev_fade_enabled(false),
+    line_hashes(emu.get_screen_size().y, 0),
+    line_change_ticks(emu.get_screen_size().y, 0),
+    fade_first(0),
+    fade_end(0),
+    content_version(0),
+    band_history(ctx.get_image_count(), uvec2(0)),
+    image_versions(ctx.get_image_count(), UINT64_MAX),
     color_lut(ctx, get_readonly_path("data/gbc_lut.png"), VK_IMAGE_LAYOUT_GENERAL),
     subpixel(ctx, get_readonly_path("data/subpixel.png")),
     subpixel_sampler(ctx),
     stage_timer(ctx, "emulator_render_stage")
 {
+    // Two extra slots: one for the emulator to write in, and one in transit.
+    size_t slot_count = ctx.get_image_count() + 2;
+    size_t slot_size = emu.get_screen_size().x*emu.get_screen_size().y;
+    void* mapped = nullptr;
+    framebuffer_buffer = create_mapped_buffer(
+        ctx,
+        slot_count*slot_size*sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        &mapped
+    );
+    memset(mapped, 0xFF, slot_count*slot_size*sizeof(uint32_t));
+    for(size_t i = 0; i < slot_count; ++i)
+    {
+        framebuffer_slots.push_back((uint32_t*)mapped + i*slot_size);
+        owned_slots.push_back(i >= 2);
+    }
+    in_flight_slots.resize(ctx.get_image_count(), -1);
+    current_slot = slot_count-1;
+    emu.set_framebuffer_slots(framebuffer_slots);
+
+    fade_pipeline.init(
+        sizeof(emulator_fade_comp_shader_binary),
+        emulator_fade_comp_shader_binary,
+        ctx.get_image_count(),
+        {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+            {3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        }
+    );
+
     transform_pipeline.init(
         sizeof(emulator_transform_comp_shader_binary),
         emulator_transform_comp_shader_binary,
         ctx.get_image_count(), 
         {
             {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
-            {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
             {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
             {3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
         },
         sizeof(push_constants)
     );
 
-    push_constants pc = {
-        emu.get_screen_size(),
-        color_mapping ? 1u : 0u,
-        apply_gamma ? 1u : 0u,
-        0
-    };
     ivec2 pixel_size = target.get_size()/emu.get_screen_size();
 
     // Thinking is too hard
-    for(unsigned h = subpixel.get_size().y; h >= pixel_size.y; ++pc.mip_layer, h/=2);
-    if(pc.mip_layer > 0) pc.mip_layer--;
+    for(unsigned h = subpixel.get_size().y; h >= pixel_size.y; ++mip_layer, h/=2);
+    if(mip_layer > 0) mip_layer--;
 
     for(size_t i = 0; i < ctx.get_image_count(); ++i)
     {
         // Assign descriptors
+        fade_pipeline.set_descriptor(i, 0, {*framebuffer_buffer});
+        fade_pipeline.set_descriptor(i, 1, {drive_state.get_image_view(i)});
+        fade_pipeline.set_descriptor(i, 2, {fade_state.get_image_view(i)});
+        fade_pipeline.set_descriptor(i, 3, {fade_parameters[i]});
+
         transform_pipeline.set_descriptor(i, 0, {target[i].view});
-        transform_pipeline.set_descriptor(i, 1, {image_buffer[i]});
+        transform_pipeline.set_descriptor(i, 1, {fade_state.get_image_view(i)});
         transform_pipeline.set_descriptor(i, 2, {color_lut.get_image_view(i)});
         transform_pipeline.set_descriptor(i, 3, {subpixel.get_image_view(i)}, {subpixel_sampler.get()});
 
-        // Record command buffers
-        VkCommandBuffer cmd = compute_commands();
-        stage_timer.start(cmd, i);
+        image_layouts.push_back(target[i].layout);
+    }
+}
+
+emulator_render_stage::~emulator_render_stage()
+{
+    emu->unset_framebuffer_slots(framebuffer_slots);
+}
+
+void emulator_render_stage::update_buffers(uint32_t image_index)
+{
+    // The previous commands of this swapchain image are done by now, so the
+    // slot they read is free unless another image still uses it. There are
+    // always more owned slots than other swapchain images.
+    in_flight_slots[image_index] = -1;
+    unsigned release_slot = 0;
+    for(unsigned i = 0; i < owned_slots.size(); ++i)
+    {
+        if(owned_slots[i] && std::count(
+            in_flight_slots.begin(), in_flight_slots.end(), int(i)
+        ) == 0){
+            release_slot = i;
+            break;
+        }
+    }
+
+    int slot = emu->acquire_framebuffer_slot(release_slot);
+    if(slot >= 0)
+    {
+        owned_slots[release_slot] = false;
+        owned_slots[slot] = true;
+        current_slot = slot;
+    }
+    in_flight_slots[image_index] = current_slot;
+
+    // Figure out how long the previous and current frames have been driven
+    // since the last time we were here, in emulated time.
+    uint64_t timestamp = emu->get_framebuffer_slot_timestamp(current_slot);
+    uint64_t now = emu->get_emulated_ticks();
+    uint64_t drive_start = prev_render_ticks;
+    fade_parameters_buffer params = {
+        0.0f, 0.0f, emu->get_framebuffer_fade() ? 1u : 0u, current_slot, 0
+    };
+    if(timestamp != prev_frame_timestamp)
+    {
+        if(timestamp > prev_render_ticks)
+        {
+            params.prev_drive_time = ticks_to_seconds(timestamp - prev_render_ticks);
+            drive_start = timestamp;
+        }
+        prev_frame_timestamp = timestamp;
+    }
+    if(now > drive_start)
+    {
+        params.drive_time = ticks_to_seconds(now - drive_start);
+        prev_render_ticks = now;
+    }
+
+    update_bands(
+        now, params.prev_drive_time != 0.0f || params.drive_time != 0.0f
+    );
+    params.first_line = fade_first;
+    fade_parameters.update(image_index, params);
+
+    record_commands(image_index);
+}
+
+void emulator_render_stage::update_bands(uint64_t now, bool fade_running)
+{
+    const uint64_t* hashes = emu->get_framebuffer_slot_line_hashes(current_slot);
+    bool fade_enabled = emu->get_framebuffer_fade();
+    if(fade_enabled != prev_fade_enabled)
+    {
+        force_full = true;
+        prev_fade_enabled = fade_enabled;
+    }
+
+    // Lines that changed go through the fade, and so do lines that are still
+    // settling towards their driven color if time has passed.
+    unsigned height = line_hashes.size();
+    fade_first = height;
+    fade_end = 0;
+    for(unsigned y = 0; y < height; ++y)
+    {
+        bool active = false;
+        if(force_full || hashes[y] != line_hashes[y])
+        {
+            line_hashes[y] = hashes[y];
+            line_change_ticks[y] = now;
+            active = true;
+        }
+        else if(
+            fade_enabled && fade_running &&
+            now - line_change_ticks[y] < FADE_SETTLE_TICKS
+        ) active = true;
+
+        if(active)
+        {
+            fade_first = min(fade_first, y);
+            fade_end = y+1;
+        }
+    }
+    force_full = false;
+
+    if(fade_first < fade_end)
+    {
+        content_version++;
+        band_history[content_version % band_history.size()] =
+            uvec2(fade_first, fade_end);
+    }
+    else fade_first = fade_end = 0;
+}
+
+void emulator_render_stage::record_commands(uint32_t image_index)
+{
+    uint32_t i = image_index;
+    uvec2 screen_size = emu->get_screen_size();
+    uvec2 size = target.get_size();
+
+    // Find the lines that changed since this image was last rendered. If the
+    // image is too far behind, it's simply rendered in full.
+    uvec2 band = uvec2(0, screen_size.y);
+    uint64_t version = image_versions[i];
+    if(version != UINT64_MAX && content_version - version <= band_history.size())
+    {
+        band = uvec2(screen_size.y, 0);
+        for(uint64_t v = version+1; v <= content_version; ++v)
+        {
+            uvec2 b = band_history[v % band_history.size()];
+            band = uvec2(min(band.x, b.x), max(band.y, b.y));
+        }
+    }
+    image_versions[i] = content_version;
+
+    clear_commands();
+    VkCommandBuffer cmd = compute_commands(true);
+    stage_timer.start(cmd, i);
+
+    if(fade_first < fade_end)
+    {
+        fade_parameters.upload(cmd, i);
+        fade_pipeline.bind(cmd, i);
+        vkCmdDispatch(
+            cmd, (screen_size.x+7)/8, (fade_end-fade_first+7)/8, 1
+        );
+        image_barrier(
+            cmd,
+            fade_state.get_image(i),
+            fade_state.get_format(),
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_LAYOUT_GENERAL
+        );
+    }
 
-        image_buffer.upload(cmd, i);
+    // Output rows whose source line is in the band.
+    uint32_t first_row = (band.x*size.y+screen_size.y-1)/screen_size.y;
+    uint32_t end_row = (band.y*size.y+screen_size.y-1)/screen_size.y;
+    bool render = first_row < end_row;
+    if(render)
+    {
+        push_constants pc = {
+            screen_size,
+            color_mapping ? 1u : 0u,
+            apply_gamma ? 1u : 0u,
+            mip_layer,
+            (int32_t)first_row
+        };
         transform_pipeline.bind(cmd, i);
         transform_pipeline.push_constants(cmd, &pc);
 
-        target.transition_layout(cmd, i, VK_IMAGE_LAYOUT_GENERAL);
-
-        ivec2 size = target.get_size();
-        vkCmdDispatch(cmd, (size.x+7)/8, (size.y+7)/8, 1);
+        image_barrier(
+            cmd, target[i].image, target.get_format(),
+            image_layouts[i], VK_IMAGE_LAYOUT_GENERAL
+        );
+        vkCmdDispatch(cmd, (size.x+7)/8, (end_row-first_row+7)/8, 1);
 
         if(!do_generate_mipmaps)
         {
-            target.transition_layout(cmd, i, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            stage_timer.stop(cmd, i);
+            image_barrier(
+                cmd, target[i].image, target.get_format(),
+                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+            );
         }
+        image_layouts[i] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
 
-        use_compute_commands(cmd, i);
+    // The same number of command buffers must be submitted every frame, even
+    // if there's nothing for the second one to do.
+    if(!do_generate_mipmaps)
+        stage_timer.stop(cmd, i);
+    use_compute_commands(cmd, i);
 
-        if(do_generate_mipmaps)
+    if(do_generate_mipmaps)
+    {
+        VkCommandBuffer cmd = graphics_commands(true);
+        if(render)
         {
-            VkCommandBuffer cmd = graphics_commands();
             generate_mipmaps(
                 cmd,
                 target[i].image,
                 target.get_format(),
-                target.get_size(),
+                size,
                 VK_IMAGE_LAYOUT_GENERAL,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                first_row,
+                end_row
             );
-            stage_timer.stop(cmd, i);
-            use_graphics_commands(cmd, i);
         }
+        stage_timer.stop(cmd, i);
+        use_graphics_commands(cmd, i);
     }
 }
-
-void emulator_render_stage::update_buffers(uint32_t image_index)
-{
-    emu->lock_framebuffer();
-    image_buffer.update(image_index, emu->get_framebuffer_data());
-    emu->unlock_framebuffer();
-}
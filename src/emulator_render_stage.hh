@@ -8,10 +8,18 @@
 #include "texture.hh"
 #include "sampler.hh"
 #include "emulator.hh"
+#include "render_target.hh"
 
-class render_target;
-// Simply uploads the emulator's framebuffer to a texture with the specified
-// color & subpixel transformations. Can also generate mipmaps.
+// Simply transfers the emulator's framebuffer to a texture with the specified
+// color & subpixel transformations. Can also generate mipmaps. The LCD pixel
+// transitions are also simulated here, if the emulator has them enabled.
+//
+// The emulator draws directly into a ring of persistently mapped slots owned
+// by this stage, which the GPU then reads from; no CPU copies are involved.
+//
+// Only the scanlines that changed, or are still fading, are processed each
+// frame. When nothing changes, the output images are left as they are, so
+// commands are recorded anew for every frame.
 class emulator_render_stage: public render_stage
 {
 public:
@@ -23,14 +31,49 @@ public:
         bool color_mapping = false,
         bool apply_gamma = false
     );
+    ~emulator_render_stage();
 
 protected:
     void update_buffers(uint32_t image_index) override;
 
 private:
+    void update_bands(uint64_t now, bool fade_running);
+    void record_commands(uint32_t image_index);
+
     emulator* emu;
+    render_target target;
+    bool do_generate_mipmaps;
+    bool color_mapping;
+    bool apply_gamma;
+    int32_t mip_layer;
+    compute_pipeline fade_pipeline;
     compute_pipeline transform_pipeline;
-    gpu_buffer image_buffer;
+    vkres<VkBuffer> framebuffer_buffer;
+    std::vector<uint32_t*> framebuffer_slots;
+    std::vector<bool> owned_slots;
+    // The slot that each swapchain image's commands last read from.
+    std::vector<int> in_flight_slots;
+    unsigned current_slot;
+    gpu_buffer fade_parameters;
+    texture drive_state;
+    texture fade_state;
+    uint64_t prev_frame_timestamp;
+    uint64_t prev_render_ticks;
+
+    // Change tracking. Lines in [fade_first, fade_end) need to go through the
+    // fade this frame. Each change to fade_state bumps content_version, and
+    // the changed lines of the latest versions are kept in band_history, so
+    // that an output image a few versions behind can be brought up to date.
+    bool force_full;
+    bool prev_fade_enabled;
+    std::vector<uint64_t> line_hashes;
+    std::vector<uint64_t> line_change_ticks;
+    unsigned fade_first, fade_end;
+    uint64_t content_version;
+    std::vector<uvec2> band_history;
+    // UINT64_MAX if the image has no valid contents yet.
+    std::vector<uint64_t> image_versions;
+    std::vector<VkImageLayout> image_layouts;
     texture color_lut;
     texture subpixel;
     sampler subpixel_sampler;
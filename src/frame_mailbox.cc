@@ -0,0 +1,40 @@
+#include "frame_mailbox.hh"
+
+frame_mailbox::frame_mailbox(unsigned slot_count)
+{
+    reset(slot_count);
+}
+
+void frame_mailbox::reset(unsigned slot_count)
+{
+    this->slot_count = slot_count;
+    middle = 1;
+    write_slot = 0;
+}
+
+unsigned frame_mailbox::get_slot_count() const
+{
+    return slot_count;
+}
+
+unsigned frame_mailbox::get_write_slot() const
+{
+    return write_slot;
+}
+
+void frame_mailbox::publish()
+{
+    uint8_t prev = middle.exchange(
+        write_slot | FRESH_BIT, std::memory_order_acq_rel
+    );
+    write_slot = prev & ~FRESH_BIT;
+}
+
+int frame_mailbox::acquire(unsigned release_slot)
+{
+    if(!(middle.load(std::memory_order_relaxed) & FRESH_BIT))
+        return -1;
+
+    uint8_t prev = middle.exchange(release_slot, std::memory_order_acq_rel);
+    return prev & ~FRESH_BIT;
+}
@@ -0,0 +1,46 @@
+#ifndef RAYBOY_FRAME_MAILBOX_HH
+#define RAYBOY_FRAME_MAILBOX_HH
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of completed frames from one writer thread to one reader
+// thread. The frames themselves live in a fixed number of slots allocated by
+// the user; this class only tracks who owns which slot. The writer always owns
+// one slot and one slot is in transit between the threads. The reader owns
+// all the rest and may hold on to several of them, e.g. while the GPU is still
+// reading them. Neither side ever waits for the other, and frames that are
+// published faster than they are read are simply skipped.
+class frame_mailbox
+{
+public:
+    // Initially, the writer owns slot 0, slot 1 is in transit and the reader
+    // owns the rest.
+    frame_mailbox(unsigned slot_count = 3);
+    frame_mailbox(const frame_mailbox& other) = delete;
+
+    // Not thread safe, both sides must be stopped while this is called.
+    void reset(unsigned slot_count);
+    unsigned get_slot_count() const;
+
+    // Writer side. publish() hands the current write slot over to the reader
+    // and gives the writer a new one.
+    unsigned get_write_slot() const;
+    void publish();
+
+    // Reader side. If a new frame has been published since the last call,
+    // gives release_slot to the writer in exchange and returns the slot of
+    // the new frame. Otherwise, returns -1 and the reader keeps
+    // release_slot.
+    int acquire(unsigned release_slot);
+
+private:
+    static constexpr uint8_t FRESH_BIT = 0x80;
+
+    // Slot in transit, with FRESH_BIT set if the writer has published it and
+    // the reader hasn't picked it up yet.
+    std::atomic<uint8_t> middle;
+    uint8_t write_slot;
+    unsigned slot_count;
+};
+
+#endif
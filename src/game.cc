@@ -95,10 +95,11 @@ game::game(const char* initial_rom)
     load_options(opt);
     gfx_ctx.reset(new context(opt.window_size, opt.fullscreen, opt.vsync));
     window_size = opt.window_size;
-    audio_ctx.reset(new audio());
-    ui.reset(new gui(*gfx_ctx, opt));
+    audio_ctx.reset(new audio(opt.audio_samplerate, opt.audio_buffer_size));
     emu.reset(new emulator(*audio_ctx));
+    ui.reset(new gui(*gfx_ctx, opt, *emu));
     emu->set_power(true);
+    emu->set_run_ahead(opt.run_ahead_frames);
 
     if(initial_rom && emu->load_rom(initial_rom))
     {
@@ -352,6 +353,26 @@ bool game::handle_input()
             if(event.key.keysym.sym == SDLK_t && event.type == SDL_KEYDOWN)
             {
                 gfx_ctx->dump_timing();
+                emu->dump_timing();
+            }
+            if(event.key.keysym.sym == SDLK_TAB && event.key.repeat == 0)
+            {
+                emu->set_turbo(
+                    event.type == SDL_KEYDOWN ? opt.turbo_speed : 1
+                );
+            }
+            if(event.key.keysym.sym == SDLK_r && event.key.repeat == 0)
+            {
+                emu->set_rewinding(event.type == SDL_KEYDOWN);
+            }
+            // Ignore key repeat, holding the key would flip it back and
+            // forth.
+            if(
+                event.key.keysym.sym == SDLK_p &&
+                event.type == SDL_KEYDOWN && event.key.repeat == 0
+            )
+            {
+                emu->set_paused(!emu->is_paused());
             }
             handle_emulator_input(*emu, event);
             break;
@@ -364,6 +385,10 @@ bool game::handle_input()
             {
                 emu->load_sav(event.drop.file);
             }
+            else if(path.extension() == ".rbm")
+            {
+                emu->play_movie(event.drop.file);
+            }
             else if(path.extension() == ".gbc" || path.extension() == ".gb")
             {
                 if(emu->load_rom(event.drop.file))
@@ -427,6 +452,20 @@ bool game::handle_input()
             case gui::SET_SCENE:
                 load_scene(opt.scene);
                 break;
+            case gui::SET_RUN_AHEAD:
+                emu->set_run_ahead(opt.run_ahead_frames);
+                break;
+            case gui::RECORD_MOVIE:
+                emu->start_recording((const char*)event.user.data1);
+                SDL_free(event.user.data1);
+                break;
+            case gui::STOP_MOVIE:
+                emu->stop_movie();
+                break;
+            case gui::SET_AUDIO_FORMAT:
+                audio_ctx->set_format(opt.audio_samplerate, opt.audio_buffer_size);
+                emu->reset_audio_output();
+                break;
             }
             break;
         }
@@ -484,6 +523,7 @@ void game::update()
 
     update_button_animations();
     updater.update(ecs_scene);
+    transformable::update_global_transforms();
     audio_ctx->update();
 }
 
@@ -25,9 +25,10 @@ void push_file_event(const char* name)
 
 }
 
-gui::gui(context& ctx, options& opts)
-:   ctx(&ctx), opts(&opts), show_menubar(true), show_controls(false),
-    show_license(false), show_about(false)
+gui::gui(context& ctx, options& opts, emulator& emu)
+:   ctx(&ctx), opts(&opts), emu(&emu), show_menubar(true),
+    show_controls(false), show_license(false), show_about(false),
+    show_profiler(false)
 {
     ImGui::CreateContext();
     static std::string ini_path = (get_writable_path()/"imgui.ini").string();
@@ -81,6 +82,12 @@ void gui::update()
             ImGui::EndMenu();
         }
 
+        if(ImGui::BeginMenu("Emulation"))
+        {
+            menu_emulation();
+            ImGui::EndMenu();
+        }
+
         if(ImGui::BeginMenu("Help"))
         {
             menu_help();
@@ -96,6 +103,7 @@ void gui::update()
     if(show_controls) help_controls();
     if(show_license) help_license();
     if(show_about) help_about();
+    if(show_profiler) emulation_profiler();
 
     ImGui::Render();
 }
@@ -132,6 +140,38 @@ void gui::menu_file()
         }
     }
 
+    if(ImGui::MenuItem("Record movie"))
+    {
+        nfdchar_t* file_path = nullptr;
+        if(NFD_SaveDialog("rbm", NULL, &file_path) == NFD_OKAY)
+        {
+            SDL_Event e;
+            e.type = SDL_USEREVENT;
+            e.user.code = RECORD_MOVIE;
+            e.user.data1 = SDL_strdup(file_path);
+            SDL_PushEvent(&e);
+            free(file_path);
+        }
+    }
+
+    if(ImGui::MenuItem("Play movie"))
+    {
+        nfdchar_t* file_path = nullptr;
+        if(NFD_OpenDialog("rbm", NULL, &file_path) == NFD_OKAY)
+        {
+            push_file_event(file_path);
+            free(file_path);
+        }
+    }
+
+    if(ImGui::MenuItem("Stop movie"))
+    {
+        SDL_Event e;
+        e.type = SDL_USEREVENT;
+        e.user.code = STOP_MOVIE;
+        SDL_PushEvent(&e);
+    }
+
     if(ImGui::MenuItem("Quit"))
     {
         SDL_Event e;
@@ -517,6 +557,139 @@ void gui::menu_graphics()
     }
 }
 
+void gui::menu_emulation()
+{
+    if(ImGui::BeginMenu("Run-ahead"))
+    {
+        static constexpr struct {
+            const char* name;
+            unsigned value;
+        } run_ahead_options[] = {
+            {"Off", 0},
+            {"1 frame", 1},
+            {"2 frames", 2},
+            {"3 frames", 3},
+            {"4 frames", 4}
+        };
+        for(auto [name, value]: run_ahead_options)
+        {
+            if(ImGui::MenuItem(name, NULL, value == opts->run_ahead_frames))
+            {
+                opts->run_ahead_frames = value;
+                SDL_Event e;
+                e.type = SDL_USEREVENT;
+                e.user.code = SET_RUN_AHEAD;
+                SDL_PushEvent(&e);
+            }
+        }
+        ImGui::EndMenu();
+    }
+
+    if(ImGui::BeginMenu("Fast-forward speed"))
+    {
+        static constexpr struct {
+            const char* name;
+            unsigned value;
+        } turbo_options[] = {
+            {"2x", 2},
+            {"4x", 4},
+            {"8x", 8},
+            {"Uncapped", 0}
+        };
+        for(auto [name, value]: turbo_options)
+        {
+            if(ImGui::MenuItem(name, NULL, value == opts->turbo_speed))
+                opts->turbo_speed = value;
+        }
+        ImGui::EndMenu();
+    }
+
+    if(ImGui::BeginMenu("Audio sample rate"))
+    {
+        static constexpr struct {
+            const char* name;
+            unsigned value;
+        } samplerate_options[] = {
+            {"Native", 0},
+            {"44100 Hz", 44100},
+            {"48000 Hz", 48000},
+            {"96000 Hz", 96000}
+        };
+        // Show what the device actually gave, that's what "Native" ends up
+        // as and what the others may have been changed into.
+        unsigned device_samplerate = emu->get_profile().audio_device_samplerate;
+        std::string native_name = "Native (" +
+            std::to_string(device_samplerate) + " Hz)";
+        for(auto [name, value]: samplerate_options)
+        {
+            if(value == 0 && opts->audio_samplerate == 0 && device_samplerate)
+                name = native_name.c_str();
+            if(ImGui::MenuItem(name, NULL, value == opts->audio_samplerate))
+            {
+                opts->audio_samplerate = value;
+                SDL_Event e;
+                e.type = SDL_USEREVENT;
+                e.user.code = SET_AUDIO_FORMAT;
+                SDL_PushEvent(&e);
+            }
+        }
+        ImGui::EndMenu();
+    }
+
+    if(ImGui::BeginMenu("Audio buffer size"))
+    {
+        static constexpr struct {
+            const char* name;
+            unsigned value;
+        } buffer_size_options[] = {
+            {"128 samples", 128},
+            {"256 samples", 256},
+            {"512 samples", 512},
+            {"1024 samples", 1024},
+            {"2048 samples", 2048}
+        };
+        for(auto [name, value]: buffer_size_options)
+        {
+            if(ImGui::MenuItem(name, NULL, value == opts->audio_buffer_size))
+            {
+                opts->audio_buffer_size = value;
+                SDL_Event e;
+                e.type = SDL_USEREVENT;
+                e.user.code = SET_AUDIO_FORMAT;
+                SDL_PushEvent(&e);
+            }
+        }
+        ImGui::EndMenu();
+    }
+
+    ImGui::Separator();
+    if(ImGui::MenuItem("Profiler", NULL, show_profiler))
+        show_profiler = !show_profiler;
+}
+
+void gui::emulation_profiler()
+{
+    if(ImGui::Begin("Emulation profiler", &show_profiler, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        emulator::profile p = emu->get_profile();
+        ImGui::Text("Host time spent per second:");
+        ImGui::Text("  GB_run:     %6.2f ms", p.run_time*1e3);
+        ImGui::Text("  Vblank:     %6.2f ms", p.vblank_time*1e3);
+        ImGui::Text("  Audio:      %6.2f ms", p.audio_time*1e3);
+        ImGui::Text("  Lock wait:  %6.2f ms", p.lock_wait_time*1e3);
+        ImGui::Text("  Link wait:  %6.2f ms", p.link_wait_time*1e3);
+        ImGui::Separator();
+        ImGui::Text("Slices per second:  %.1f", p.slices_per_second);
+        ImGui::Text("GB_run calls/slice: %.0f", p.run_calls_per_slice);
+        ImGui::Separator();
+        ImGui::Text("Audio buffered:     %.1f ms", p.audio_buffered*1e3);
+        ImGui::Text("Audio rate:         %+.3f %%", (p.audio_rate_ratio-1.0)*100.0);
+        ImGui::Text("Audio latency:      %.1f ms", p.audio_latency*1e3);
+        ImGui::Text("Audio device rate:  %u Hz", p.audio_device_samplerate);
+    }
+    ImGui::End();
+}
+
 void gui::help_controls()
 {
     if(ImGui::Begin("Controls", &show_controls, ImGuiWindowFlags_AlwaysAutoResize))
@@ -541,6 +714,9 @@ Keyboard controls:
     [return]            = Start button
     [Left alt]          = Toggle menu bar
     [F11]               = Toggle fullscreen
+    [p]                 = Pause emulation
+    [Tab (hold)]        = Fast-forward
+    [r (hold)]          = Rewind
 
 Controller (XBOX binds, other controllers have something else):
     [Right stick]   = Rotate console
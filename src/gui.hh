@@ -3,11 +3,12 @@
 
 #include "context.hh"
 #include "options.hh"
+#include "emulator.hh"
 
 class gui
 {
 public:
-    gui(context& ctx, options& opts);
+    gui(context& ctx, options& opts, emulator& emu);
     ~gui();
 
     enum option_events
@@ -23,7 +24,12 @@ public:
         SET_RENDERING_MODE,
         SET_GB_COLOR,
         SET_RT_OPTION,
-        SET_SCENE
+        SET_SCENE,
+        SET_RUN_AHEAD,
+        // data1 is the path, to be freed with SDL_free().
+        RECORD_MOVIE,
+        STOP_MOVIE,
+        SET_AUDIO_FORMAT
     };
 
     void handle_event(const SDL_Event& event);
@@ -33,17 +39,21 @@ private:
     void menu_file();
     void menu_window();
     void menu_graphics();
+    void menu_emulation();
     void menu_help();
     void help_controls();
     void help_license();
     void help_about();
+    void emulation_profiler();
 
     bool show_menubar;
     bool show_controls;
     bool show_license;
     bool show_about;
+    bool show_profiler;
     context* ctx;
     options* opts;
+    emulator* emu;
 };
 
 #endif
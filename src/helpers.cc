@@ -157,6 +157,41 @@ vkres<VkBuffer> create_cpu_buffer(
     return vkres<VkBuffer>(ctx, buffer, alloc);
 }
 
+vkres<VkBuffer> create_mapped_buffer(
+    context& ctx,
+    size_t bytes,
+    VkBufferUsageFlags usage,
+    void** mapped
+){
+    VkBufferCreateInfo info = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        nullptr,
+        0,
+        bytes,
+        usage,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        nullptr
+    };
+    VmaAllocationCreateInfo alloc_info = {};
+    alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    alloc_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    alloc_info.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    VkBuffer buffer;
+    VmaAllocation alloc;
+    VmaAllocationInfo result_info;
+    vmaCreateBuffer(
+        ctx.get_device().allocator, &info,
+        &alloc_info, &buffer,
+        &alloc, &result_info
+    );
+    *mapped = result_info.pMappedData;
+
+    return vkres<VkBuffer>(ctx, buffer, alloc);
+}
+
 vkres<VkImage> create_gpu_image(
     context& ctx,
     uvec2 size,
@@ -247,9 +282,12 @@ void generate_mipmaps(
     VkFormat format,
     uvec2 size,
     VkImageLayout before,
-    VkImageLayout after
+    VkImageLayout after,
+    uint32_t first_row,
+    uint32_t end_row
 ){
     unsigned mipmap_count = calculate_mipmap_count(size);
+    uvec2 rows = uvec2(first_row, min(end_row, size.y));
     if(before != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
     {
         image_barrier(
@@ -266,11 +304,20 @@ void generate_mipmaps(
             i-1, 1
         );
         uvec2 next_size = max(size/2u, uvec2(1));
+        // Rows only map exactly to the next level when the height halves
+        // evenly; after that, whole levels are updated.
+        uvec2 next_rows = uvec2(0, next_size.y);
+        uvec2 src_rows = uvec2(0, size.y);
+        if(size.y % 2 == 0 && rows != uvec2(0, size.y))
+        {
+            next_rows = uvec2(rows.x/2, (rows.y+1)/2);
+            src_rows = next_rows * 2u;
+        }
         VkImageBlit blit = {
             {VK_IMAGE_ASPECT_COLOR_BIT, i-1, 0, 1},
-            {{0,0,0}, {(int32_t)size.x, (int32_t)size.y, 1}},
+            {{0,(int32_t)src_rows.x,0}, {(int32_t)size.x, (int32_t)src_rows.y, 1}},
             {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1},
-            {{0,0,0}, {(int32_t)next_size.x, (int32_t)next_size.y, 1}}
+            {{0,(int32_t)next_rows.x,0}, {(int32_t)next_size.x, (int32_t)next_rows.y, 1}}
         };
         vkCmdBlitImage(
             cmd,
@@ -280,6 +327,7 @@ void generate_mipmaps(
             VK_FILTER_LINEAR
         );
         size = next_size;
+        rows = next_rows;
         image_barrier(
             cmd, img, format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, after, i-1, 1
         );
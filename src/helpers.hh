@@ -23,6 +23,10 @@ void wait_timeline_semaphore(context& ctx, VkSemaphore sem, uint64_t wait_value)
 vkres<VkShaderModule> load_shader(context& ctx, size_t bytes, const uint32_t* data);
 vkres<VkBuffer> create_gpu_buffer(context& ctx, size_t bytes, VkBufferUsageFlags usage);
 vkres<VkBuffer> create_cpu_buffer(context& ctx, size_t bytes, void* initial_data = nullptr);
+// The returned buffer stays mapped at *mapped for its whole lifetime, and
+// the memory is host-coherent so no flushes are needed. Host-cached memory
+// is preferred, so that reading it back on the CPU isn't terribly slow.
+vkres<VkBuffer> create_mapped_buffer(context& ctx, size_t bytes, VkBufferUsageFlags usage, void** mapped);
 vkres<VkImage> create_gpu_image(
     context& ctx,
     uvec2 size,
@@ -37,13 +41,17 @@ vkres<VkImage> create_gpu_image(
     bool mipmapped = false
 );
 
+// If only the rows in [first_row, end_row) of the base level have changed,
+// only the corresponding rows of the other levels are updated.
 void generate_mipmaps(
     VkCommandBuffer cmd,
     VkImage img,
     VkFormat format,
     uvec2 size,
     VkImageLayout before,
-    VkImageLayout after
+    VkImageLayout after,
+    uint32_t first_row = 0,
+    uint32_t end_row = UINT32_MAX
 );
 
 void copy_buffer(
@@ -0,0 +1,106 @@
+#include "transformable.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Transform hierarchy benchmark. Loads a scene of the given number of nodes
+// into an ECS the same way the glTF loader does, moves its root and updates
+// all global transforms, then unloads it one node at a time like
+// gltf_data::remove() does. Each node gets up to branching_factor children,
+// filled in depth-first order.
+namespace
+{
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+}
+
+// Iterative with an explicit stack, so that deep hierarchies like chains
+// don't run out of call stack.
+void load_nodes(
+    ecs& ctx,
+    std::vector<entity>& ids,
+    unsigned count,
+    unsigned branching_factor
+){
+    struct pending_node
+    {
+        transformable* parent;
+        // Nodes in the subtree of this node, including itself.
+        unsigned count;
+    };
+    std::vector<pending_node> stack = {{nullptr, count}};
+    while(stack.size() != 0)
+    {
+        pending_node pending = stack.back();
+        stack.pop_back();
+
+        entity id = ctx.add(transformable());
+        ids.push_back(id);
+        transformable* node = ctx.get<transformable>(id);
+        node->set_position(vec3(0.1f, 0.0f, 0.0f));
+        node->set_orientation(10.0f, vec3(0, 1, 0));
+        node->set_parent(pending.parent);
+
+        // The remaining nodes are split evenly between the children. They
+        // are pushed in reverse, so that the first child is loaded first.
+        unsigned remaining = pending.count - 1;
+        size_t first_child = stack.size();
+        for(unsigned i = 0; i < branching_factor && remaining > 0; ++i)
+        {
+            unsigned child_count = (remaining + branching_factor - 1 - i) /
+                (branching_factor - i);
+            stack.push_back({node, child_count});
+            remaining -= child_count;
+        }
+        std::reverse(stack.begin() + first_child, stack.end());
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 3)
+    {
+        fprintf(stderr, "Usage: %s [node_count] [branching_factor]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned node_count = argc >= 2 ? strtoul(argv[1], nullptr, 10) : 10000;
+    unsigned branching_factor = argc >= 3 ? strtoul(argv[2], nullptr, 10) : 4;
+    if(node_count == 0 || branching_factor == 0)
+    {
+        fprintf(stderr, "Node count and branching factor must be positive\n");
+        return 1;
+    }
+
+    ecs ctx;
+    std::vector<entity> ids;
+    ids.reserve(node_count);
+
+    auto start = std::chrono::steady_clock::now();
+    load_nodes(ctx, ids, node_count, branching_factor);
+    double load_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    ctx.get<transformable>(ids[0])->rotate(1.0f, vec3(0, 1, 0));
+    transformable::update_global_transforms();
+    double update_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for(entity id: ids)
+        ctx.remove(id);
+    double unload_time = seconds_since(start);
+
+    printf("Nodes:            %u\n", node_count);
+    printf("Load:             %.3f ms\n", load_time*1e3);
+    printf("Transform update: %.3f ms\n", update_time*1e3);
+    printf("Unload:           %.3f ms\n", unload_time*1e3);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "input_movie.hh"
+#include <algorithm>
+#include <fstream>
+
+// The file starts with a header of little-endian integers, followed by the
+// initial save state. Each event is then the varint-encoded tick delta from
+// the previous event, followed by the button in the low bits and the pressed
+// state in the highest bit of one byte.
+namespace
+{
+
+constexpr char MAGIC[4] = {'R', 'B', 'M', 'V'};
+constexpr uint64_t VERSION = 1;
+constexpr uint8_t PRESSED_BIT = 0x80;
+constexpr uint8_t BUTTON_COUNT = 8;
+
+uint8_t* write_u64(uint8_t* out, uint64_t value)
+{
+    for(unsigned i = 0; i < 8; ++i)
+        *out++ = value >> (i*8);
+    return out;
+}
+
+bool read_u64(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+    if(end - in < 8) return false;
+    value = 0;
+    for(unsigned i = 0; i < 8; ++i)
+        value |= uint64_t(*in++) << (i*8);
+    return true;
+}
+
+size_t varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while(value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+uint8_t* write_varint(uint8_t* out, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+bool read_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if(in == end) return false;
+        uint8_t byte = *in++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+}
+
+bool input_movie::read(const std::string& path, size_t state_size)
+{
+    std::ifstream f(path, std::ios::binary|std::ios::ate);
+    if(!f) return false;
+    std::vector<uint8_t> data(f.tellg());
+    f.seekg(0);
+    if(!f.read((char*)data.data(), data.size()))
+        return false;
+
+    // Every size is checked against what's left of the file before anything
+    // is allocated for it, so a corrupt file can't ask for a huge buffer.
+    const uint8_t* in = data.data();
+    const uint8_t* end = in + data.size();
+    if(end - in < 4 || !std::equal(in, in+4, MAGIC))
+        return false;
+    in += 4;
+
+    uint64_t version, size;
+    if(
+        !read_u64(in, end, version) || version != VERSION ||
+        !read_u64(in, end, rom_hash) ||
+        !read_u64(in, end, length_ticks) ||
+        !read_u64(in, end, size) ||
+        size != state_size || size > uint64_t(end - in)
+    ) return false;
+    initial_state.assign(in, in + size);
+    in += size;
+
+    // Each event takes at least two bytes.
+    if(!read_u64(in, end, size) || size > uint64_t(end - in)/2)
+        return false;
+    events.resize(size);
+    uint64_t ticks = 0;
+    for(event& e: events)
+    {
+        uint64_t delta;
+        if(!read_varint(in, end, delta) || in == end)
+            return false;
+        uint8_t flags = *in++;
+        ticks += delta;
+        e.ticks = ticks;
+        e.button = flags & ~PRESSED_BIT;
+        e.pressed = flags & PRESSED_BIT;
+        if(e.button >= BUTTON_COUNT)
+            return false;
+    }
+    return in == end;
+}
+
+size_t input_movie::get_serialized_size() const
+{
+    size_t size = sizeof(MAGIC) + 5*8 + initial_state.size();
+    uint64_t ticks = 0;
+    for(const event& e: events)
+    {
+        size += varint_size(e.ticks - ticks) + 1;
+        ticks = e.ticks;
+    }
+    return size;
+}
+
+void input_movie::serialize(uint8_t* out) const
+{
+    out = std::copy(MAGIC, MAGIC+4, out);
+    out = write_u64(out, VERSION);
+    out = write_u64(out, rom_hash);
+    out = write_u64(out, length_ticks);
+    out = write_u64(out, initial_state.size());
+    out = std::copy(initial_state.begin(), initial_state.end(), out);
+
+    out = write_u64(out, events.size());
+    uint64_t ticks = 0;
+    for(const event& e: events)
+    {
+        out = write_varint(out, e.ticks - ticks);
+        *out++ = e.button | (e.pressed ? PRESSED_BIT : 0);
+        ticks = e.ticks;
+    }
+}
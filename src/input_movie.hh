@@ -0,0 +1,33 @@
+#ifndef RAYBOY_INPUT_MOVIE_HH
+#define RAYBOY_INPUT_MOVIE_HH
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Recording of a play session that replays bit-exactly: the state the
+// recording started from and every button change after it, timed in
+// emulated ticks from the start.
+struct input_movie
+{
+    struct event
+    {
+        uint64_t ticks;
+        uint8_t button;
+        bool pressed;
+    };
+
+    // Movies only replay correctly on the ROM they were recorded with.
+    uint64_t rom_hash = 0;
+    uint64_t length_ticks = 0;
+    std::vector<uint8_t> initial_state;
+    std::vector<event> events;
+
+    // Fails if the file is truncated or otherwise malformed, or if its
+    // initial state isn't state_size bytes long.
+    bool read(const std::string& path, size_t state_size);
+    // The file contents, for handing over to a save_writer.
+    size_t get_serialized_size() const;
+    void serialize(uint8_t* out) const;
+};
+
+#endif
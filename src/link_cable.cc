@@ -0,0 +1,171 @@
+#include "link_cable.hh"
+#include <algorithm>
+
+namespace
+{
+
+// Bits of one byte are sent back-to-back. A longer pause than two bits at the
+// slowest serial clock means that a new transfer has started.
+constexpr uint64_t TRANSFER_GAP_TICKS = TICKS_PER_SECOND/4096;
+// Enough for a few bytes at the fastest serial clock, within the skew.
+constexpr size_t LINK_QUEUE_SIZE = 1024;
+// A side that is stuck, e.g. because another thread holds its emulator for a
+// long time, doesn't stall the other one for longer than this.
+constexpr auto LINK_TIMEOUT = std::chrono::milliseconds(100);
+
+}
+
+link_cable::side::side()
+:   emu(nullptr), base_ticks(0), ticks(0), running(false), waiting(false),
+    wake_ticks(0), data(0xFF), incoming(LINK_QUEUE_SIZE), has_next_bit(false),
+    bit_index(0), last_bit_ticks(0), partner_data(0xFF), wait_time(0)
+{
+}
+
+link_cable::link_cable(emulator& a, emulator& b, uint64_t max_skew)
+: max_skew(max_skew), transferred_bits(0), stall_count(0), closed(false)
+{
+    sides[0].emu = &a;
+    sides[1].emu = &b;
+    a.connect_link(this, 0);
+    b.connect_link(this, 1);
+}
+
+link_cable::~link_cable()
+{
+    // Let go of any waiting side first, it holds its emulator's mutex.
+    closed = true;
+    notify();
+    for(side& s: sides)
+        s.emu->disconnect_link();
+}
+
+uint64_t link_cable::get_max_skew() const
+{
+    return max_skew;
+}
+
+uint64_t link_cable::get_transferred_bits() const
+{
+    return transferred_bits;
+}
+
+uint64_t link_cable::get_stall_count() const
+{
+    return stall_count;
+}
+
+void link_cable::sync(unsigned index, uint64_t emu_ticks, uint8_t data)
+{
+    side& self = sides[index];
+    side& other = sides[index^1];
+    uint64_t t = emu_ticks - self.base_ticks;
+    // The data must be in place by the time the other side sees the ticks.
+    self.data.store(data, std::memory_order_relaxed);
+    self.ticks = t;
+
+    if(other.waiting && t >= other.wake_ticks)
+        notify();
+
+    wait_for_partner(index, t > max_skew ? t - max_skew : 0);
+}
+
+void link_cable::set_running(unsigned index, uint64_t emu_ticks, bool running)
+{
+    side& self = sides[index];
+    side& other = sides[index^1];
+    if(running && other.running)
+    {
+        // Skip over the time this side was stopped for.
+        uint64_t t = std::max(self.ticks.load(), other.ticks.load());
+        self.base_ticks = emu_ticks - t;
+        self.ticks = t;
+    }
+    self.running = running;
+    if(!running) notify();
+}
+
+bool link_cable::receive(unsigned index, uint64_t emu_ticks, bool& bit)
+{
+    side& self = sides[index];
+    if(!self.has_next_bit)
+    {
+        if(!self.incoming.pop(self.next_bit))
+            return false;
+        self.has_next_bit = true;
+    }
+
+    if(self.next_bit.ticks > emu_ticks - self.base_ticks)
+        return false;
+
+    bit = self.next_bit.bit;
+    self.has_next_bit = false;
+    return true;
+}
+
+void link_cable::send_clocked_bit(unsigned index, uint64_t emu_ticks, bool bit)
+{
+    side& self = sides[index];
+    side& other = sides[index^1];
+    uint64_t t = emu_ticks - self.base_ticks;
+    if(self.bit_index == 0 || t - self.last_bit_ticks > TRANSFER_GAP_TICKS)
+    {
+        // The other side may still be behind, with a serial register that it
+        // is yet to write. Games do exactly that: the side with the external
+        // clock loads its next byte just before the clocking side starts.
+        self.ticks = t;
+        wait_for_partner(index, t);
+        // An unplugged cable reads as all ones.
+        self.partner_data = other.running ?
+            other.data.load(std::memory_order_relaxed) : 0xFF;
+        self.bit_index = 0;
+    }
+    self.last_bit_ticks = t;
+    // If the queue is full, the other side isn't reading anyway.
+    other.incoming.push({t, bit});
+    transferred_bits++;
+}
+
+bool link_cable::receive_clocked_bit(unsigned index)
+{
+    side& self = sides[index];
+    bool bit = (self.partner_data >> (7 - self.bit_index)) & 1;
+    self.bit_index = (self.bit_index + 1) % 8;
+    return bit;
+}
+
+void link_cable::wait_for_partner(unsigned index, uint64_t ticks)
+{
+    side& self = sides[index];
+    side& other = sides[index^1];
+    // If the other side is waiting too, both are clocking a transfer at the
+    // same time. That doesn't work on real hardware either, so just go on.
+    auto may_run = [&]{
+        return closed || !other.running || other.waiting || other.ticks >= ticks;
+    };
+    if(may_run()) return;
+
+    stall_count++;
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock lock(mutex);
+    self.wake_ticks = ticks;
+    self.waiting = true;
+    if(other.waiting) cv.notify_all();
+    cv.wait_for(lock, LINK_TIMEOUT, may_run);
+    self.waiting = false;
+    self.wait_time += std::chrono::steady_clock::now() - start;
+}
+
+std::chrono::steady_clock::duration link_cable::take_wait_time(unsigned index)
+{
+    side& self = sides[index];
+    auto wait_time = self.wait_time;
+    self.wait_time = wait_time.zero();
+    return wait_time;
+}
+
+void link_cable::notify()
+{
+    std::unique_lock lock(mutex);
+    cv.notify_all();
+}
@@ -0,0 +1,107 @@
+#ifndef RAYBOY_LINK_CABLE_HH
+#define RAYBOY_LINK_CABLE_HH
+#include "emulator.hh"
+#include "spsc_queue.hh"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Connects the serial ports of two emulators in the same process. Both keep
+// running on their own threads; instead of stepping in lockstep, neither is
+// allowed to get more than max_skew emulated ticks ahead of the other. Bits
+// arrive on the other side at the emulated time they were sent. The clocking
+// side waits at the start of each transfer until the other side has caught
+// up, and then receives the byte that it had in its serial register at that
+// moment.
+//
+// Both emulators must outlive the cable. Run-ahead and rewinding are
+// unavailable while linked, as bits that were already sent can't be taken
+// back.
+class link_cable
+{
+public:
+    link_cable(
+        emulator& a,
+        emulator& b,
+        uint64_t max_skew = TICKS_PER_SECOND/60
+    );
+    link_cable(const link_cable& other) = delete;
+    ~link_cable();
+
+    uint64_t get_max_skew() const;
+    // Bits clocked over the cable so far, in either direction.
+    uint64_t get_transferred_bits() const;
+    // How many times one side had to wait for the other to catch up.
+    uint64_t get_stall_count() const;
+
+private:
+    friend class emulator;
+
+    struct bit_event
+    {
+        uint64_t ticks;
+        bool bit;
+    };
+
+    struct side
+    {
+        side();
+
+        emulator* emu;
+        // Emulator ticks at cable time zero. Shifted forward when the side
+        // resumes, so that it doesn't have to catch up on time it was
+        // stopped for.
+        uint64_t base_ticks;
+        // Cable time this side has reached.
+        std::atomic_uint64_t ticks;
+        // Nobody waits for a side that isn't emulating.
+        std::atomic_bool running;
+        std::atomic_bool waiting;
+        // A waiting side is woken up once the other one reaches this.
+        std::atomic_uint64_t wake_ticks;
+        // Contents of the serial data register as of ticks.
+        std::atomic_uint8_t data;
+        // Bits on their way to this side. The next one is taken out as soon
+        // as it's seen, like the emulator does with inputs.
+        spsc_queue<bit_event> incoming;
+        bool has_next_bit;
+        bit_event next_bit;
+        // Progress of the transfer this side is clocking.
+        unsigned bit_index;
+        uint64_t last_bit_ticks;
+        uint8_t partner_data;
+        // Host time spent waiting for the other side, only touched by the
+        // thread of this side.
+        std::chrono::steady_clock::duration wait_time;
+    };
+
+    // These are called by the emulators from their emulating threads, with
+    // their own mutex held.
+
+    // Publishes the progress of the side, and waits if it's too far ahead.
+    void sync(unsigned index, uint64_t emu_ticks, uint8_t data);
+    void set_running(unsigned index, uint64_t emu_ticks, bool running);
+    // Returns true and the bit if one is due on this side by now.
+    bool receive(unsigned index, uint64_t emu_ticks, bool& bit);
+    // For the side that clocks the transfer.
+    void send_clocked_bit(unsigned index, uint64_t emu_ticks, bool bit);
+    bool receive_clocked_bit(unsigned index);
+    // Returns the time waited since the previous call.
+    std::chrono::steady_clock::duration take_wait_time(unsigned index);
+
+    // Waits until the other side has reached the given cable time, unless
+    // it can't get there.
+    void wait_for_partner(unsigned index, uint64_t ticks);
+    void notify();
+
+    uint64_t max_skew;
+    side sides[2];
+    std::atomic_uint64_t transferred_bits;
+    std::atomic_uint64_t stall_count;
+    std::atomic_bool closed;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+#endif
@@ -474,6 +474,17 @@ unsigned calculate_mipmap_count(uvec2 size)
     return (unsigned)std::floor(std::log2(std::max(size.x, size.y)))+1u;
 }
 
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
 struct frustum operator*(const mat4& mat, const struct frustum& f)
 {
     struct frustum res = f;
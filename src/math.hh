@@ -168,6 +168,9 @@ uvec2 string_to_resolution(const std::string& str);
 
 unsigned calculate_mipmap_count(uvec2 size);
 
+// 64-bit FNV-1a. Pass the previous result as hash to continue hashing.
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325);
+
 // axis-aligned bounding box
 struct aabb
 {
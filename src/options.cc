@@ -23,6 +23,10 @@ json options::serialize() const
     j["scene"] = scene;
     j["accumulation"] = accumulation;
     j["secondary_shadows"] = secondary_shadows;
+    j["run_ahead_frames"] = run_ahead_frames;
+    j["turbo_speed"] = turbo_speed;
+    j["audio_samplerate"] = audio_samplerate;
+    j["audio_buffer_size"] = audio_buffer_size;
     return j;
 }
 
@@ -61,6 +65,10 @@ bool options::deserialize(const json& j)
         scene = j.value("scene", "white_room");
         accumulation = j.value("accumulation", -1);
         secondary_shadows = j.value("secondary_shadows", false);
+        run_ahead_frames = j.value("run_ahead_frames", 0);
+        turbo_speed = j.value("turbo_speed", 4);
+        audio_samplerate = j.value("audio_samplerate", 0);
+        audio_buffer_size = j.value("audio_buffer_size", 512);
     }
     catch(...)
     {
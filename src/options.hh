@@ -24,6 +24,11 @@ struct options
     std::string scene = "white_room";
     int accumulation = -1;
     bool secondary_shadows = false;
+    unsigned run_ahead_frames = 0;
+    unsigned turbo_speed = 4;
+    // 0 is the native rate of the audio device.
+    unsigned audio_samplerate = 0;
+    unsigned audio_buffer_size = 512;
 
     json serialize() const;
     bool deserialize(const json& j);
@@ -0,0 +1,260 @@
+#include "rewind_buffer.hh"
+#include <cstring>
+
+namespace
+{
+
+// Zero runs shorter than this are cheaper to store as literals.
+constexpr size_t MIN_ZERO_RUN = 4;
+constexpr size_t MAX_RUN = 0xFFFF;
+
+void write_u16(uint8_t* out, size_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+size_t read_u16(const uint8_t* in)
+{
+    return in[0] | (size_t(in[1]) << 8);
+}
+
+// Each token has a 4-byte header and covers at least as many bytes unless
+// a run hits MAX_RUN or the data ends, so this is plenty.
+size_t max_encoded_size(size_t state_size)
+{
+    return state_size + 8 * (state_size / MAX_RUN + 2);
+}
+
+}
+
+rewind_buffer::rewind_buffer(size_t budget)
+:   state_size(0), has_latest(false), storage(budget), storage_head(0),
+    state_count(0), used_memory(0), pending{false, false}, capture_index(0),
+    compress_index(0), quit(false)
+{
+    compressor = std::thread(&rewind_buffer::compressor_func, this);
+}
+
+rewind_buffer::~rewind_buffer()
+{
+    {
+        std::unique_lock lock(mutex);
+        quit = true;
+        cv.notify_all();
+    }
+    compressor.join();
+}
+
+void rewind_buffer::reset(size_t state_size)
+{
+    std::unique_lock lock(mutex);
+    wait_idle(lock);
+
+    if(this->state_size != state_size)
+    {
+        this->state_size = state_size;
+        latest.resize(state_size);
+        scratch.resize(max_encoded_size(state_size));
+        for(std::vector<uint8_t>& snapshot: snapshots)
+            snapshot.resize(state_size);
+    }
+    has_latest = false;
+    storage_head = 0;
+    entries.clear();
+    state_count = 0;
+    used_memory = 0;
+}
+
+size_t rewind_buffer::get_state_size() const
+{
+    return state_size;
+}
+
+uint8_t* rewind_buffer::begin_capture()
+{
+    std::unique_lock lock(mutex);
+    if(state_size == 0 || pending[capture_index])
+        return nullptr;
+    return snapshots[capture_index].data();
+}
+
+void rewind_buffer::end_capture()
+{
+    std::unique_lock lock(mutex);
+    pending[capture_index] = true;
+    capture_index ^= 1;
+    cv.notify_all();
+}
+
+bool rewind_buffer::step_back(uint8_t* state)
+{
+    std::unique_lock lock(mutex);
+    wait_idle(lock);
+
+    if(!has_latest)
+        return false;
+
+    memcpy(state, latest.data(), state_size);
+    if(entries.size() == 0)
+    {
+        has_latest = false;
+        used_memory = 0;
+    }
+    else
+    {
+        entry e = entries.back();
+        entries.pop_back();
+        apply_delta(storage.data() + e.offset, e.size, latest.data());
+        storage_head = e.offset;
+        used_memory -= e.size;
+    }
+    state_count = entries.size() + has_latest;
+    return true;
+}
+
+size_t rewind_buffer::get_state_count() const
+{
+    return state_count;
+}
+
+size_t rewind_buffer::get_used_memory() const
+{
+    return used_memory;
+}
+
+void rewind_buffer::compressor_func()
+{
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        cv.wait(lock, [&]{ return quit || pending[compress_index]; });
+        if(quit) break;
+
+        // The capturing side doesn't touch a pending snapshot, nor the
+        // history while waiting for this to go idle.
+        lock.unlock();
+        compress(snapshots[compress_index].data());
+        lock.lock();
+
+        pending[compress_index] = false;
+        compress_index ^= 1;
+        cv.notify_all();
+    }
+}
+
+void rewind_buffer::compress(const uint8_t* state)
+{
+    if(!has_latest)
+    {
+        memcpy(latest.data(), state, state_size);
+        has_latest = true;
+        used_memory = state_size;
+        state_count = 1;
+        return;
+    }
+
+    size_t size = encode_delta(
+        state, latest.data(), state_size, scratch.data()
+    );
+    memcpy(latest.data(), state, state_size);
+
+    if(size > storage.size())
+    {
+        // Can't fit even one delta, so the history is just the latest state.
+        entries.clear();
+        storage_head = 0;
+        used_memory = state_size;
+        state_count = 1;
+        return;
+    }
+
+    // Entries are allocated in order, so the oldest ones are always the first
+    // to be in the way.
+    size_t used = used_memory;
+    if(storage_head + size > storage.size())
+    {
+        // The tail of the storage is skipped, so whatever is left there goes
+        // first. Those are the oldest entries, since everything allocated
+        // after them is before the head.
+        while(entries.size() != 0 && entries.front().offset >= storage_head)
+        {
+            used -= entries.front().size;
+            entries.pop_front();
+        }
+        storage_head = 0;
+    }
+
+    while(entries.size() != 0)
+    {
+        const entry& e = entries.front();
+        if(e.offset >= storage_head + size || e.offset + e.size <= storage_head)
+            break;
+        used -= e.size;
+        entries.pop_front();
+    }
+
+    memcpy(storage.data() + storage_head, scratch.data(), size);
+    entries.push_back({storage_head, size});
+    storage_head += size;
+    used_memory = used + size;
+    state_count = entries.size() + 1;
+}
+
+void rewind_buffer::wait_idle(std::unique_lock<std::mutex>& lock)
+{
+    cv.wait(lock, [&]{ return !pending[0] && !pending[1]; });
+}
+
+size_t rewind_buffer::encode_delta(
+    const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out
+){
+    // Tokens are a 16-bit count of zeroes to skip, then a 16-bit count of
+    // literal bytes that follow the header.
+    size_t i = 0;
+    uint8_t* start = out;
+    while(i < size)
+    {
+        size_t zeros = 0;
+        while(i < size && zeros < MAX_RUN && a[i] == b[i])
+        {
+            ++i;
+            ++zeros;
+        }
+
+        uint8_t* header = out;
+        out += 4;
+        size_t literals = 0;
+        while(i < size && literals < MAX_RUN)
+        {
+            if(a[i] == b[i])
+            {
+                size_t run = 1;
+                while(i+run < size && run < MIN_ZERO_RUN && a[i+run] == b[i+run])
+                    ++run;
+                if(run == MIN_ZERO_RUN || i+run == size)
+                    break;
+            }
+            *out++ = a[i] ^ b[i];
+            ++i;
+            ++literals;
+        }
+        write_u16(header, zeros);
+        write_u16(header+2, literals);
+    }
+    return out - start;
+}
+
+void rewind_buffer::apply_delta(
+    const uint8_t* delta, size_t size, uint8_t* state
+){
+    const uint8_t* end = delta + size;
+    while(delta < end)
+    {
+        state += read_u16(delta);
+        size_t literals = read_u16(delta+2);
+        delta += 4;
+        for(size_t i = 0; i < literals; ++i)
+            *state++ ^= *delta++;
+    }
+}
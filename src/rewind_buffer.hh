@@ -0,0 +1,84 @@
+#ifndef RAYBOY_REWIND_BUFFER_HH
+#define RAYBOY_REWIND_BUFFER_HH
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// History of save states within a fixed memory budget. Only the latest state
+// is kept as-is; every older one is stored as a run-length encoded XOR delta
+// against the state after it, so stepping backwards just applies one delta.
+// When the budget runs out, the oldest deltas are dropped.
+//
+// Capturing is cheap for the emulator thread: it only copies the state into
+// one of two snapshot buffers, and the encoding happens in a separate thread.
+// If both snapshots are still waiting to be encoded, the capture is skipped
+// instead of waiting. All other functions must be called from the capturing
+// thread too.
+class rewind_buffer
+{
+public:
+    rewind_buffer(size_t budget);
+    rewind_buffer(const rewind_buffer& other) = delete;
+    ~rewind_buffer();
+
+    // Drops all history and sets the size of the states to come.
+    void reset(size_t state_size);
+    size_t get_state_size() const;
+
+    // Returns the buffer to write the next state in, or nullptr if the
+    // capture should be skipped. end_capture() must be called after writing
+    // the state.
+    uint8_t* begin_capture();
+    void end_capture();
+
+    // Writes the latest state into the given buffer and removes it from the
+    // history. Returns false if there is no history left.
+    bool step_back(uint8_t* state);
+
+    // These can be called from any thread.
+    size_t get_state_count() const;
+    size_t get_used_memory() const;
+
+private:
+    struct entry
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    void compressor_func();
+    void compress(const uint8_t* state);
+    void wait_idle(std::unique_lock<std::mutex>& lock);
+    static size_t encode_delta(
+        const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out
+    );
+    static void apply_delta(const uint8_t* delta, size_t size, uint8_t* state);
+
+    size_t state_size;
+    bool has_latest;
+    std::vector<uint8_t> latest;
+    std::vector<uint8_t> scratch;
+
+    // Deltas are allocated from this like from a ring buffer.
+    std::vector<uint8_t> storage;
+    size_t storage_head;
+    std::deque<entry> entries;
+    std::atomic_size_t state_count;
+    std::atomic_size_t used_memory;
+
+    std::vector<uint8_t> snapshots[2];
+    bool pending[2];
+    unsigned capture_index;
+    unsigned compress_index;
+
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread compressor;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "save_writer.hh"
+#include <cstdio>
+#include <filesystem>
+
+save_writer::save_writer()
+: filling(-1), writing(-1), pending(-1), generation(0),
+    pending_generation(0), written_generation(0), failed_generation(0),
+    quit(false)
+{
+    writer = std::thread(&save_writer::writer_func, this);
+}
+
+save_writer::~save_writer()
+{
+    {
+        std::unique_lock lock(mutex);
+        quit = true;
+        cv.notify_all();
+    }
+    writer.join();
+}
+
+uint8_t* save_writer::begin_write(size_t size)
+{
+    std::unique_lock lock(mutex);
+    filling = writing == 0 ? 1 : 0;
+    // A pending write in the same buffer is outdated by this one.
+    if(pending == filling)
+        pending = -1;
+    buffers[filling].resize(size);
+    return buffers[filling].data();
+}
+
+uint64_t save_writer::end_write(const std::string& path)
+{
+    std::unique_lock lock(mutex);
+    pending = filling;
+    pending_path = path;
+    pending_generation = ++generation;
+    filling = -1;
+    cv.notify_all();
+    return generation;
+}
+
+bool save_writer::wait(uint64_t generation)
+{
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&]{ return written_generation >= generation; });
+    return failed_generation < generation;
+}
+
+uint64_t save_writer::get_failed_generation()
+{
+    std::unique_lock lock(mutex);
+    return failed_generation;
+}
+
+void save_writer::writer_func()
+{
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        cv.wait(lock, [&]{ return quit || pending >= 0; });
+        if(pending < 0) break;
+
+        writing = pending;
+        pending = -1;
+        std::string path = pending_path;
+        uint64_t write_generation = pending_generation;
+        const std::vector<uint8_t>& data = buffers[writing];
+        lock.unlock();
+
+        std::string tmp_path = path + ".tmp";
+        FILE* f = fopen(tmp_path.c_str(), "wb");
+        bool ok = f && fwrite(data.data(), 1, data.size(), f) == data.size();
+        if(f) ok = fclose(f) == 0 && ok;
+
+        std::error_code err;
+        if(ok) std::filesystem::rename(tmp_path, path, err);
+        ok = ok && !err;
+        if(ok) printf("Saved to %s\n", path.c_str());
+        else printf("Failed to save to %s\n", path.c_str());
+
+        lock.lock();
+        writing = -1;
+        written_generation = write_generation;
+        if(!ok) failed_generation = write_generation;
+        cv.notify_all();
+    }
+}
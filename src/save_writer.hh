@@ -0,0 +1,57 @@
+#ifndef RAYBOY_SAVE_WRITER_HH
+#define RAYBOY_SAVE_WRITER_HH
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Writes save files in a background thread, so that the caller never waits
+// on the disk. The data is first written into a temporary file which then
+// replaces the actual one, so a crash mid-write can't corrupt the save. If
+// new data comes in while the previous write is still going, only the newest
+// one is written after it. Each write gets a generation number, which the
+// caller can use to find out whether its data made it to disk.
+class save_writer
+{
+public:
+    save_writer();
+    save_writer(const save_writer& other) = delete;
+    // Finishes all pending writes.
+    ~save_writer();
+
+    // Returns a buffer of the given size to fill with the save data, then
+    // end_write() must be called. The buffers only grow, so they don't
+    // allocate after the first few saves. Only one thread may write at a
+    // time.
+    uint8_t* begin_write(size_t size);
+    // Returns the generation of the write, starting from 1.
+    uint64_t end_write(const std::string& path);
+
+    // Blocks until the given generation has been written, or replaced by a
+    // newer one that has. Returns false if that write failed.
+    bool wait(uint64_t generation);
+    // The latest generation whose write failed, 0 if none has.
+    uint64_t get_failed_generation();
+
+private:
+    void writer_func();
+
+    std::vector<uint8_t> buffers[2];
+    int filling;
+    int writing;
+    int pending;
+    std::string pending_path;
+    uint64_t generation;
+    uint64_t pending_generation;
+    uint64_t written_generation;
+    uint64_t failed_generation;
+
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread writer;
+};
+
+#endif
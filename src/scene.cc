@@ -7,9 +7,12 @@
 #include "environment_map.hh"
 #include "gltf.hh"
 #include "error.hh"
+#include <atomic>
 #include <initializer_list>
 
 #define INSTANCES_BUFFER_ALIGNMENT 16
+// Entities per task when packing instances in parallel.
+#define INSTANCE_BATCH_SIZE 32
 
 namespace
 {
@@ -108,6 +111,9 @@ bool scene::update(uint32_t image_index)
 {
     size_t instance_count = 0;
     bool outdated = false;
+    // The instances are packed in parallel, so the transforms must be ready
+    // before that.
+    transformable::update_global_transforms();
 
     e->foreach([&](entity id, model& m) { instance_count += m.group_count(); });
     check_error(
@@ -138,66 +144,79 @@ bool scene::update(uint32_t image_index)
         });
     });
 
+    // The per-entity map entries are created while gathering, so that the
+    // packing itself can run on the thread pool.
+    std::atomic_bool any_outdated(false);
     instances.update<gpu_instance>(image_index, [&](gpu_instance* data) {
-        size_t i = 0;
-        e->foreach([&](entity id, transformable& t, model& m, visible&) {
-            mat4 mat = t.get_global_transform();
-            mat4 inv = inverseTranspose(mat);
-            std::vector<uint32_t>& instances = entity_instances[id];
-            instances.clear();
-            mat4 prev_mvp = mat4(NAN);
-            if(old_mvps.count(id))
-                prev_mvp = old_mvps[id];
-            old_mvps[id] = vp * mat;
-
-            for(const model::vertex_group& group: m)
-            {
-                instances.push_back(i);
-                gpu_instance& inst = data[i++];
-                inst.model_to_world = mat;
-                inst.normal_to_world = inv;
-                inst.prev_mvp = prev_mvp;
-                inst.material.color_factor = group.mat.color_factor;
-                inst.material.metallic_roughness_normal_ior_factors = vec4(
-                    group.mat.metallic_factor,
-                    group.mat.roughness_factor,
-                    group.mat.normal_factor,
-                    group.mat.ior
-                );
-                inst.material.emission_transmittance_factors = vec4(
-                    group.mat.emission_factor,
-                    group.mat.transmittance
-                );
-                inst.material.textures = {
-                    get_st_index(group.mat.color_texture, outdated),
-                    get_st_index(group.mat.metallic_roughness_texture, outdated),
-                    get_st_index(group.mat.normal_texture, outdated),
-                    get_st_index(group.mat.emission_texture, outdated),
-                };
-                inst.environment_mesh = ivec4(-1);
-                if(group.mat.envmap != nullptr)
+        parallel_foreach<transformable, model, visible>(
+            *e, pool, INSTANCE_BATCH_SIZE,
+            [&](entity id, transformable& t, model& m, visible&) {
+                entity_instances[id];
+                old_mvps.try_emplace(id, mat4(NAN));
+                return m.group_count();
+            },
+            [&](entity id, size_t i, transformable& t, model& m, visible&) {
+                mat4 mat = t.get_global_transform();
+                mat4 inv = inverseTranspose(mat);
+                std::vector<uint32_t>& instances = entity_instances.at(id);
+                instances.resize(m.group_count());
+                for(size_t j = 0; j < instances.size(); ++j)
+                    instances[j] = i + j;
+                mat4& old_mvp = old_mvps.at(id);
+                mat4 prev_mvp = old_mvp;
+                old_mvp = vp * mat;
+
+                bool entity_outdated = false;
+                for(const model::vertex_group& group: m)
                 {
-                    auto eit = envmap_indices.find(group.mat.envmap);
-                    if(eit == envmap_indices.end())
+                    gpu_instance& inst = data[i++];
+                    inst.model_to_world = mat;
+                    inst.normal_to_world = inv;
+                    inst.prev_mvp = prev_mvp;
+                    inst.material.color_factor = group.mat.color_factor;
+                    inst.material.metallic_roughness_normal_ior_factors = vec4(
+                        group.mat.metallic_factor,
+                        group.mat.roughness_factor,
+                        group.mat.normal_factor,
+                        group.mat.ior
+                    );
+                    inst.material.emission_transmittance_factors = vec4(
+                        group.mat.emission_factor,
+                        group.mat.transmittance
+                    );
+                    inst.material.textures = {
+                        get_st_index(group.mat.color_texture, entity_outdated),
+                        get_st_index(group.mat.metallic_roughness_texture, entity_outdated),
+                        get_st_index(group.mat.normal_texture, entity_outdated),
+                        get_st_index(group.mat.emission_texture, entity_outdated),
+                    };
+                    inst.environment_mesh = ivec4(-1);
+                    if(group.mat.envmap != nullptr)
                     {
-                        outdated = true;
-                        return;
+                        auto eit = envmap_indices.find(group.mat.envmap);
+                        if(eit == envmap_indices.end())
+                        {
+                            entity_outdated = true;
+                            break;
+                        }
+                        inst.environment_mesh.x = eit->second;
+                        inst.environment_mesh.y = eit->second+1;
                     }
-                    inst.environment_mesh.x = eit->second;
-                    inst.environment_mesh.y = eit->second+1;
-                }
-                inst.environment_mesh.z = get_st_index(group.mat.lightmap, outdated);
+                    inst.environment_mesh.z = get_st_index(group.mat.lightmap, entity_outdated);
 
-                auto mesh_it = mesh_indices.find(group.mesh);
-                if(mesh_it == mesh_indices.end())
-                {
-                    outdated = true;
-                    return;
+                    auto mesh_it = mesh_indices.find(group.mesh);
+                    if(mesh_it == mesh_indices.end())
+                    {
+                        entity_outdated = true;
+                        break;
+                    }
+                    inst.environment_mesh.w = mesh_it->second;
                 }
-                inst.environment_mesh.w = mesh_it->second;
+                if(entity_outdated) any_outdated = true;
             }
-        });
+        );
     });
+    if(any_outdated) outdated = true;
 
     point_lights.update<gpu_point_light>(image_index, [&](gpu_point_light* data){
         size_t i = 0;
@@ -230,31 +249,35 @@ bool scene::update(uint32_t image_index)
     if(ray_tracing)
     {
         rt_instances.update<uint8_t>(image_index, [&](uint8_t* deviceptr) {
-            rt_instance_count = 0;
-            size_t i = 0;
             VkAccelerationStructureInstanceKHR *base = (VkAccelerationStructureInstanceKHR*)(deviceptr + INSTANCES_BUFFER_ALIGNMENT - ((uintptr_t)deviceptr % INSTANCES_BUFFER_ALIGNMENT));
-            e->foreach([&](entity id, transformable& t, model& m, visible&, ray_traced* rt) {
-                mat4 transform = transpose(t.get_global_transform());
-                for(const model::vertex_group& group: m)
-                {
-                    if(rt)
+            // The custom indices point to the instances packed above.
+            rt_instance_count = parallel_foreach<transformable, model, visible, ray_traced*>(
+                *e, pool, INSTANCE_BATCH_SIZE,
+                [&](entity id, transformable& t, model& m, visible&, ray_traced* rt) {
+                    return rt ? m.group_count() : 0;
+                },
+                [&](entity id, size_t i, transformable& t, model& m, visible&, ray_traced* rt) {
+                    if(!rt) return;
+                    mat4 transform = transpose(t.get_global_transform());
+                    const std::vector<uint32_t>& instances = entity_instances.at(id);
+                    size_t j = 0;
+                    for(const model::vertex_group& group: m)
                     {
-                        base[rt_instance_count] = {
-                            {}, (uint32_t)i,
+                        base[i] = {
+                            {}, instances[j++],
                             group.mat.potentially_transparent() && !rt->refraction ? 2u : 1u,
                             0,
                             VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
                             group.mesh->get_blas_address()
                         };
                         memcpy(
-                            &base[rt_instance_count].transform, &transform,
-                            sizeof(base[rt_instance_count].transform)
+                            &base[i].transform, &transform,
+                            sizeof(base[i].transform)
                         );
-                        rt_instance_count++;
+                        i++;
                     }
-                    i++;
                 }
-            });
+            );
         });
     }
     return !outdated;
@@ -104,6 +104,9 @@ private:
     sampler radiance_sampler;
     sampler irradiance_sampler;
     vkres<VkBuffer> filler_buffer;
+
+    // Packs the instances in update().
+    thread_pool pool;
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef RAYBOY_SPSC_QUEUE_HH
+#define RAYBOY_SPSC_QUEUE_HH
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Lock-free queue from one producer thread to one consumer thread. The
+// capacity is fixed at creation and rounded up to a power of two. The two
+// indices are kept on separate cache lines, so the threads don't keep
+// stealing the line from each other.
+template<typename T>
+class spsc_queue
+{
+public:
+    spsc_queue(size_t capacity);
+    spsc_queue(const spsc_queue& other) = delete;
+
+    // Producer side. Returns false and drops the value if the queue is full.
+    bool push(const T& value);
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T& value);
+
+    size_t size() const;
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    // Only written by the consumer.
+    alignas(64) std::atomic_size_t head;
+    // Only written by the producer.
+    alignas(64) std::atomic_size_t tail;
+};
+
+#include "spsc_queue.tcc"
+#endif
@@ -0,0 +1,43 @@
+#ifndef RAYBOY_SPSC_QUEUE_TCC
+#define RAYBOY_SPSC_QUEUE_TCC
+
+template<typename T>
+spsc_queue<T>::spsc_queue(size_t capacity)
+: head(0), tail(0)
+{
+    size_t size = 1;
+    while(size < capacity) size <<= 1;
+    buffer.resize(size);
+    mask = size-1;
+}
+
+template<typename T>
+bool spsc_queue<T>::push(const T& value)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) > mask)
+        return false;
+    buffer[t & mask] = value;
+    tail.store(t+1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool spsc_queue<T>::pop(T& value)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire))
+        return false;
+    value = buffer[h & mask];
+    head.store(h+1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+size_t spsc_queue<T>::size() const
+{
+    return tail.load(std::memory_order_acquire) -
+        head.load(std::memory_order_acquire);
+}
+
+#endif
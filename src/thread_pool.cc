@@ -0,0 +1,104 @@
+#include "thread_pool.hh"
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned thread_count)
+: job(nullptr), generation(0), busy_threads(0), quit(false)
+{
+    // hardware_concurrency() may not know.
+    thread_count = std::max(thread_count, 1u);
+    for(unsigned i = 0; i < thread_count; ++i)
+        queues.emplace_back(new task_queue);
+    for(unsigned i = 0; i < thread_count; ++i)
+        threads.emplace_back(&thread_pool::worker_func, this, i);
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::unique_lock lock(mutex);
+        quit = true;
+        start_cv.notify_all();
+    }
+    for(std::thread& t: threads)
+        t.join();
+}
+
+unsigned thread_pool::get_thread_count() const
+{
+    return threads.size();
+}
+
+void thread_pool::parallel_for(
+    size_t count, const std::function<void(size_t)>& func
+){
+    if(count == 0) return;
+
+    std::unique_lock lock(mutex);
+    size_t thread_count = queues.size();
+    for(size_t i = 0; i < thread_count; ++i)
+    {
+        std::unique_lock queue_lock(queues[i]->mutex);
+        for(size_t j = i*count/thread_count; j < (i+1)*count/thread_count; ++j)
+            queues[i]->tasks.push_back(j);
+    }
+
+    job = &func;
+    busy_threads = thread_count;
+    generation++;
+    start_cv.notify_all();
+    done_cv.wait(lock, [&]{ return busy_threads == 0; });
+    job = nullptr;
+}
+
+void thread_pool::worker_func(unsigned index)
+{
+    uint64_t seen_generation = 0;
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        start_cv.wait(lock, [&]{
+            return quit || generation != seen_generation;
+        });
+        if(quit) break;
+        seen_generation = generation;
+        const std::function<void(size_t)>& func = *job;
+        lock.unlock();
+
+        size_t task;
+        while(pop_task(index, task))
+            func(task);
+
+        lock.lock();
+        if(--busy_threads == 0)
+            done_cv.notify_all();
+    }
+}
+
+bool thread_pool::pop_task(unsigned index, size_t& task)
+{
+    // Own tasks are taken from the front, stolen ones from the back, so that
+    // the thread and the thieves stay out of each other's way.
+    {
+        task_queue& own = *queues[index];
+        std::unique_lock lock(own.mutex);
+        if(own.tasks.size() != 0)
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for(size_t i = 1; i < queues.size(); ++i)
+    {
+        task_queue& victim = *queues[(index + i) % queues.size()];
+        std::unique_lock lock(victim.mutex);
+        if(victim.tasks.size() != 0)
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
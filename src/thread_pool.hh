@@ -0,0 +1,50 @@
+#ifndef RAYBOY_THREAD_POOL_HH
+#define RAYBOY_THREAD_POOL_HH
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed set of worker threads for data-parallel work. Each thread gets its
+// own contiguous share of the tasks and steals from the others once it runs
+// out, so tasks of very uneven length still keep all cores busy.
+class thread_pool
+{
+public:
+    thread_pool(unsigned thread_count = std::thread::hardware_concurrency());
+    thread_pool(const thread_pool& other) = delete;
+    ~thread_pool();
+
+    unsigned get_thread_count() const;
+
+    // Calls func(i) for each i in [0, count) from the worker threads, and
+    // waits until all calls have returned. Only one thread may call this at
+    // a time.
+    void parallel_for(size_t count, const std::function<void(size_t)>& func);
+
+private:
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    void worker_func(unsigned index);
+    bool pop_task(unsigned index, size_t& task);
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> threads;
+
+    const std::function<void(size_t)>* job;
+    uint64_t generation;
+    unsigned busy_threads;
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+};
+
+#endif
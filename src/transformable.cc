@@ -1,14 +1,224 @@
 #include "transformable.hh"
-#define REVISION ++revision;
+#include <algorithm>
+
+class transform_hierarchy
+{
+public:
+    transform_hierarchy();
+
+    uint32_t add(transformable* owner, transformable* parent);
+    void remove(uint32_t slot);
+    void set_parent(uint32_t slot, transformable* parent);
+    void mark_dirty(uint32_t slot);
+    // Only computes the node and its ancestors, from the topmost changed one
+    // down. Their flags are left alone, so the next update() still passes
+    // the changes on to the rest of the hierarchy.
+    const mat4& get_global(const transformable& node);
+    void update();
+
+private:
+    // Restores parent-before-child order and drops the free slots.
+    void sort();
+
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+    // The local transform has changed since the last update.
+    static constexpr uint8_t DIRTY = 1<<0;
+    // The global transform was recomputed in the latest update.
+    static constexpr uint8_t CHANGED = 1<<1;
+
+    // Null for free slots.
+    std::vector<transformable*> owners;
+    std::vector<uint32_t> parents;
+    std::vector<mat4> locals;
+    std::vector<mat4> globals;
+    std::vector<uint8_t> flags;
+    std::vector<uint32_t> free_slots;
+    // Scratch space for get_global().
+    std::vector<uint32_t> chain;
+    bool any_dirty;
+    bool unsorted;
+};
+
+namespace
+{
+
+transform_hierarchy& hierarchy()
+{
+    static transform_hierarchy h;
+    return h;
+}
+
+}
+
+transform_hierarchy::transform_hierarchy()
+: any_dirty(false), unsorted(false)
+{
+}
+
+uint32_t transform_hierarchy::add(transformable* owner, transformable* parent)
+{
+    uint32_t slot;
+    if(free_slots.size() != 0)
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        slot = owners.size();
+        owners.push_back(nullptr);
+        parents.push_back(NO_PARENT);
+        locals.emplace_back(1);
+        globals.emplace_back(1);
+        flags.push_back(0);
+    }
+    owners[slot] = owner;
+    set_parent(slot, parent);
+    return slot;
+}
+
+void transform_hierarchy::remove(uint32_t slot)
+{
+    owners[slot] = nullptr;
+    parents[slot] = NO_PARENT;
+    flags[slot] = 0;
+    free_slots.push_back(slot);
+}
+
+void transform_hierarchy::set_parent(uint32_t slot, transformable* parent)
+{
+    parents[slot] = parent ? parent->slot : NO_PARENT;
+    if(parent && parent->slot > slot)
+        unsorted = true;
+    mark_dirty(slot);
+}
+
+void transform_hierarchy::mark_dirty(uint32_t slot)
+{
+    flags[slot] |= DIRTY;
+    any_dirty = true;
+}
+
+const mat4& transform_hierarchy::get_global(const transformable& node)
+{
+    if(!any_dirty)
+        return globals[node.slot];
+
+    // Everything above the topmost dirty ancestor is up to date.
+    chain.clear();
+    size_t dirty_count = 0;
+    for(uint32_t i = node.slot; i != NO_PARENT; i = parents[i])
+    {
+        chain.push_back(i);
+        if(flags[i] & DIRTY)
+            dirty_count = chain.size();
+    }
+
+    for(size_t j = dirty_count; j-- > 0;)
+    {
+        uint32_t i = chain[j];
+        if(flags[i] & DIRTY)
+            locals[i] = owners[i]->get_transform();
+        uint32_t p = parents[i];
+        globals[i] = p == NO_PARENT ? locals[i] : globals[p] * locals[i];
+    }
+    return globals[node.slot];
+}
+
+void transform_hierarchy::update()
+{
+    if(unsorted) sort();
+    if(!any_dirty) return;
+
+    // Parents come first, so their global transforms and CHANGED flags are
+    // already from this pass when the children get to them.
+    for(uint32_t i = 0; i < owners.size(); ++i)
+    {
+        uint8_t f = flags[i];
+        if(f & DIRTY)
+            locals[i] = owners[i]->get_transform();
+
+        uint32_t p = parents[i];
+        if(p == NO_PARENT)
+        {
+            if(f & DIRTY) globals[i] = locals[i];
+        }
+        else if((f & DIRTY) || (flags[p] & CHANGED))
+        {
+            globals[i] = globals[p] * locals[i];
+            f |= DIRTY;
+        }
+        flags[i] = (f & DIRTY) ? CHANGED : 0;
+    }
+    any_dirty = false;
+}
+
+void transform_hierarchy::sort()
+{
+    // Depth of each node, so that sorting by it puts parents first.
+    uint32_t count = owners.size();
+    std::vector<uint32_t> depths(count, NO_PARENT);
+    std::vector<uint32_t> chain;
+    std::vector<uint32_t> order;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(!owners[i]) continue;
+        order.push_back(i);
+        uint32_t node = i;
+        while(depths[node] == NO_PARENT && parents[node] != NO_PARENT)
+        {
+            chain.push_back(node);
+            node = parents[node];
+        }
+        uint32_t depth = depths[node] == NO_PARENT ? 0 : depths[node];
+        depths[node] = depth;
+        while(chain.size() != 0)
+        {
+            depths[chain.back()] = ++depth;
+            chain.pop_back();
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+        return depths[a] < depths[b];
+    });
+
+    std::vector<uint32_t> new_slots(count, NO_PARENT);
+    for(uint32_t i = 0; i < order.size(); ++i)
+        new_slots[order[i]] = i;
+
+    std::vector<transformable*> new_owners(order.size());
+    std::vector<uint32_t> new_parents(order.size());
+    std::vector<mat4> new_locals(order.size());
+    std::vector<mat4> new_globals(order.size());
+    std::vector<uint8_t> new_flags(order.size());
+    for(uint32_t i = 0; i < order.size(); ++i)
+    {
+        uint32_t old = order[i];
+        new_owners[i] = owners[old];
+        new_owners[i]->slot = i;
+        new_parents[i] = parents[old] == NO_PARENT ?
+            NO_PARENT : new_slots[parents[old]];
+        new_locals[i] = locals[old];
+        new_globals[i] = globals[old];
+        new_flags[i] = flags[old];
+    }
+    owners.swap(new_owners);
+    parents.swap(new_parents);
+    locals.swap(new_locals);
+    globals.swap(new_globals);
+    flags.swap(new_flags);
+    free_slots.clear();
+    unsorted = false;
+}
 
 basic_transformable::basic_transformable()
-:   orientation(1,0,0,0), position(0), scaling(1), revision(1)
+:   orientation(1,0,0,0), position(0), scaling(1)
 {
 }
 
 basic_transformable::basic_transformable(const basic_transformable& other)
 :   orientation(other.orientation), position(other.position),
-    scaling(other.scaling), revision(other.revision)
+    scaling(other.scaling)
 {}
 
 void basic_transformable::rotate(float angle, vec3 axis, vec3 local_origin)
@@ -16,7 +226,7 @@ void basic_transformable::rotate(float angle, vec3 axis, vec3 local_origin)
     quat rotation = angleAxis(radians(angle), axis);
     orientation = normalize(rotation * orientation);
     position += local_origin + rotation * -local_origin;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::rotate(vec3 axis_magnitude, vec3 local_origin)
@@ -44,25 +254,25 @@ void basic_transformable::rotate_local(
 void basic_transformable::rotate(quat rotation)
 {
     orientation = normalize(rotation * orientation);
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_orientation(float angle)
 {
     orientation = angleAxis(radians(angle), vec3(0,0,1));
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_orientation(float angle, vec3 axis)
 {
     orientation = angleAxis(radians(angle), normalize(axis));
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_orientation(quat orientation)
 {
     this->orientation = orientation;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_orientation(float pitch, float yaw, float roll)
@@ -74,7 +284,7 @@ void basic_transformable::set_orientation(float pitch, float yaw, float roll)
             radians(roll)
         )
     );
-    REVISION;
+    changed();
 }
 
 quat basic_transformable::get_orientation() const { return orientation; }
@@ -85,13 +295,13 @@ void basic_transformable::translate(vec2 offset)
 {
     this->position.x += offset.x;
     this->position.y += offset.y;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::translate(vec3 offset)
 {
     this->position += offset;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::translate_local(vec2 offset)
@@ -102,26 +312,26 @@ void basic_transformable::translate_local(vec2 offset)
 void basic_transformable::translate_local(vec3 offset)
 {
     this->position += orientation * offset;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_position(vec2 position)
 {
     this->position.x = position.x;
     this->position.y = position.y;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_position(vec3 position)
 {
     this->position = position;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_depth(float depth)
 {
     this->position.z = depth;
-    REVISION;
+    changed();
 }
 
 vec3 basic_transformable::get_position() const { return position; }
@@ -129,33 +339,33 @@ vec3 basic_transformable::get_position() const { return position; }
 void basic_transformable::scale(float scale)
 {
     this->scaling *= scale;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::scale(vec2 scale)
 {
     this->scaling.x *= scale.x;
     this->scaling.y *= scale.y;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::scale(vec3 scale)
 {
     this->scaling *= scale;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_scaling(vec2 scaling)
 {
     this->scaling.x = scaling.x;
     this->scaling.y = scaling.y;
-    REVISION;
+    changed();
 }
 
 void basic_transformable::set_scaling(vec3 scaling)
 {
     this->scaling = scaling;
-    REVISION;
+    changed();
 }
 vec2 basic_transformable::get_size() const { return scaling; }
 vec3 basic_transformable::get_scaling() const { return scaling; }
@@ -163,7 +373,16 @@ vec3 basic_transformable::get_scaling() const { return scaling; }
 void basic_transformable::set_transform(const mat4& transform)
 {
     decompose_matrix(transform, position, scaling, orientation);
-    REVISION;
+    changed();
+}
+
+void basic_transformable::set_transform(
+    vec3 position, quat orientation, vec3 scaling
+){
+    this->position = position;
+    this->orientation = orientation;
+    this->scaling = scaling;
+    changed();
 }
 
 mat4 basic_transformable::get_transform() const
@@ -188,7 +407,7 @@ void basic_transformable::lookat(
 
     if(angle_limit < 0) orientation = target;
     else orientation = rotate_towards(orientation, target, angle_limit);
-    REVISION;
+    changed();
 }
 
 void basic_transformable::lookat(
@@ -200,17 +419,59 @@ void basic_transformable::lookat(
     lookat(other->position, up, forward, angle_limit);
 }
 
+void basic_transformable::changed()
+{
+}
+
 transformable::transformable(transformable* parent)
-:   cached_revision(0),
-    cached_parent_revision(0),
-    parent(parent),
-    cached_transform(1)
-{}
+:   parent(parent), first_child(nullptr), prev_sibling(nullptr),
+    next_sibling(nullptr)
+{
+    slot = hierarchy().add(this, parent);
+    link_to_parent();
+}
+
+transformable::transformable(const transformable& other)
+:   basic_transformable(other), parent(other.parent), first_child(nullptr),
+    prev_sibling(nullptr), next_sibling(nullptr)
+{
+    slot = hierarchy().add(this, parent);
+    link_to_parent();
+}
+
+transformable::transformable(transformable&& other)
+:   transformable(static_cast<const transformable&>(other))
+{
+}
+
+transformable& transformable::operator=(const transformable& other)
+{
+    orientation = other.orientation;
+    position = other.position;
+    scaling = other.scaling;
+    unlink_from_parent();
+    parent = other.parent;
+    link_to_parent();
+    hierarchy().set_parent(slot, parent);
+    return *this;
+}
+
+transformable& transformable::operator=(transformable&& other)
+{
+    return *this = static_cast<const transformable&>(other);
+}
+
+transformable::~transformable()
+{
+    while(first_child)
+        first_child->set_parent(nullptr);
+    unlink_from_parent();
+    hierarchy().remove(slot);
+}
 
-const mat4& transformable::get_global_transform() const 
+mat4 transformable::get_global_transform() const
 {
-    update_cached_transform();
-    return cached_transform;
+    return hierarchy().get_global(*this);
 }
 
 vec3 transformable::get_global_position() const
@@ -259,7 +520,7 @@ void transformable::set_global_orientation(quat orientation)
     if(parent)
         orientation = inverse(parent->get_global_orientation()) * orientation;
     this->orientation = orientation;
-    REVISION;
+    changed();
 }
 
 void transformable::set_global_position(vec3 pos)
@@ -270,14 +531,14 @@ void transformable::set_global_position(vec3 pos)
             affineInverse(parent->get_global_transform()) * vec4(pos, 1)
         );
     else position = pos;
-    REVISION;
+    changed();
 }
 
 void transformable::set_global_scaling(vec3 size)
 {
     scaling = size;
     if(parent) scaling /= parent->get_global_scaling();
-    REVISION;
+    changed();
 }
 
 void transformable::set_parent(
@@ -292,10 +553,10 @@ void transformable::set_parent(
                 affineInverse(parent->get_global_transform()) * transform;
         decompose_matrix(transform, position, scaling, orientation);
     }
+    unlink_from_parent();
     this->parent = parent;
-    REVISION;
-    // Setting cached_parent_revision is unnecessary, since the changed revision
-    // should already force cache invalidation.
+    link_to_parent();
+    hierarchy().set_parent(slot, parent);
 }
 
 transformable* transformable::get_parent() const
@@ -303,6 +564,16 @@ transformable* transformable::get_parent() const
     return parent;
 }
 
+transformable* transformable::get_first_child() const
+{
+    return first_child;
+}
+
+transformable* transformable::get_next_sibling() const
+{
+    return next_sibling;
+}
+
 void transformable::lookat(
     vec3 pos,
     vec3 up,
@@ -327,7 +598,7 @@ void transformable::lookat(
 
     if(angle_limit < 0) orientation = target;
     else orientation = rotate_towards(orientation, target, angle_limit);
-    REVISION;
+    changed();
 }
 
 void transformable::lookat(
@@ -369,41 +640,68 @@ void transformable::align_to_view(
     set_orientation(quat_lookat(global_view_dir, up, -face_axis));
 }
 
-uint16_t transformable::update_cached_transform() const
+void transformable::update_global_transforms()
 {
-    if(parent)
-    {
-        uint16_t parent_revision = parent->update_cached_transform();
-        if(
-            cached_revision != revision ||
-            cached_parent_revision != parent_revision
-        ){
-            cached_transform = parent->cached_transform * get_transform();
-            cached_parent_revision = parent_revision;
-            // Local revision must change if parent transform has changed. This
-            // ensures that further children update properly.
-            cached_revision = ++revision;
-        }
-    }
-    else
-    {
-        if(cached_revision != revision)
-        {
-            cached_transform = get_transform();
-            cached_revision = ++revision;
-        }
-    }
-    return revision;
+    hierarchy().update();
+}
+
+void transformable::changed()
+{
+    hierarchy().mark_dirty(slot);
+}
+
+void transformable::link_to_parent()
+{
+    if(!parent) return;
+    prev_sibling = nullptr;
+    next_sibling = parent->first_child;
+    if(next_sibling) next_sibling->prev_sibling = this;
+    parent->first_child = this;
+}
+
+void transformable::unlink_from_parent()
+{
+    if(!parent) return;
+    if(prev_sibling) prev_sibling->next_sibling = next_sibling;
+    else parent->first_child = next_sibling;
+    if(next_sibling) next_sibling->prev_sibling = prev_sibling;
+    prev_sibling = nullptr;
+    next_sibling = nullptr;
+}
+
+void transformable_orphan_handler::handle(
+    ecs& ctx, const add_component<transformable>& e
+){
+    entities[e.data] = e.id;
 }
 
 void transformable_orphan_handler::handle(
     ecs& ctx, const remove_component<transformable>& e
 ){
-    // If the parent has been removed, the children are removed too.
-    ctx([&](entity id, transformable& t){
-        if(t.get_parent() == e.data)
-        {
-            ctx.remove(id);
-        }
-    });
+    entities.erase(e.data);
+
+    // If the parent has been removed, the children are removed too. Removing
+    // a child unlinks it from the list, so the ids are gathered first.
+    for(
+        transformable* child = e.data->get_first_child();
+        child;
+        child = child->get_next_sibling()
+    ){
+        auto it = entities.find(child);
+        if(it != entities.end())
+            orphans.push_back(it->second);
+    }
+
+    // Removing the orphans gets back here for each of them. Only the
+    // outermost call removes anything, so that the call stack doesn't grow
+    // with the depth of the hierarchy.
+    if(removing_orphans) return;
+    removing_orphans = true;
+    while(orphans.size() != 0)
+    {
+        entity id = orphans.back();
+        orphans.pop_back();
+        ctx.remove(id);
+    }
+    removing_orphans = false;
 }
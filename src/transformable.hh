@@ -2,12 +2,14 @@
 #define RAYBOY_TRANSFORMABLE_HH
 #include "math.hh"
 #include "ecs.hh"
+#include <unordered_map>
 
 class basic_transformable
 {
 public:
     basic_transformable();
     basic_transformable(const basic_transformable& other);
+    virtual ~basic_transformable() = default;
 
     void rotate(float angle, vec3 axis, vec3 local_origin = vec3(0));
     void rotate(vec3 axis_magnitude, vec3 local_origin = vec3(0));
@@ -40,6 +42,8 @@ public:
     vec3 get_scaling() const;
 
     void set_transform(const mat4& transform);
+    // Sets all parts at once, with a single change.
+    void set_transform(vec3 position, quat orientation, vec3 scaling);
     mat4 get_transform() const;
 
     void lookat(
@@ -56,12 +60,29 @@ public:
     );
 
 protected:
+    // Called after every change to the local transform.
+    virtual void changed();
+
     quat orientation;
     vec3 position, scaling;
-    mutable uint16_t revision;
 };
 
 class transformable_orphan_handler;
+class transform_hierarchy;
+
+// The global transforms of all transformables are kept in one flat hierarchy,
+// where the local and global matrices are stored in arrays with parents
+// before their children. Changes only mark the node dirty, and all dirty
+// global transforms are then updated in a single linear pass. Reading a
+// global transform in between only computes the path from its topmost
+// changed ancestor. The transformable itself is just a handle to its entry
+// in the hierarchy.
+//
+// The hierarchy is shared by every transformable in the process, whichever
+// ECS they belong to, and it isn't synchronized. Transformables may only be
+// created, changed and destroyed on one thread at a time. Other threads may
+// read global transforms concurrently only after update_global_transforms()
+// and while nothing is being changed.
 
 class transformable:
     public basic_transformable,
@@ -70,8 +91,19 @@ class transformable:
 {
 public:
     transformable(transformable* parent = nullptr);
-
-    const mat4& get_global_transform() const;
+    // Copies get the local transform and the parent of the original, but
+    // not its children. Moving is the same as copying, the children keep
+    // pointing to the original.
+    transformable(const transformable& other);
+    transformable(transformable&& other);
+    transformable& operator=(const transformable& other);
+    transformable& operator=(transformable&& other);
+    // Children of a destroyed transformable are left without a parent.
+    ~transformable();
+
+    // Computes the global transform first if it or any of its ancestors has
+    // changed.
+    mat4 get_global_transform() const;
 
     vec3 get_global_position() const;
     quat get_global_orientation() const;
@@ -91,6 +123,9 @@ public:
         bool keep_transform = false
     );
     transformable* get_parent() const;
+    // The children form a linked list through their siblings.
+    transformable* get_first_child() const;
+    transformable* get_next_sibling() const;
 
     void lookat(
         vec3 pos,
@@ -113,24 +148,47 @@ public:
         vec3 up = vec3(0,1,0),
         vec3 lock_axis = vec3(0)
     );
-    
-    uint16_t update_cached_transform() const;
+
+    // Updates the global transforms of every changed transformable. Call it
+    // once per frame after everything has moved, and always before reading
+    // global transforms from several threads.
+    static void update_global_transforms();
 
 protected:
-    mutable uint16_t cached_revision;
-    mutable uint16_t cached_parent_revision;
+    void changed() override;
+
     transformable* parent;
 
 private:
-    mutable mat4 cached_transform;
+    friend class transform_hierarchy;
+    void link_to_parent();
+    void unlink_from_parent();
+
+    transformable* first_child;
+    transformable* prev_sibling;
+    transformable* next_sibling;
+    // Index in the hierarchy, which changes when it gets reordered.
+    uint32_t slot;
 };
 
+// Removes the entities of the children when their parent is removed, and
+// their children in turn. Keeps track of which entity each transformable
+// belongs to, so that only the removed subtree is visited.
 class transformable_orphan_handler:
     public system,
-    public receiver<remove_component<transformable>>
+    public receiver<
+        add_component<transformable>,
+        remove_component<transformable>
+    >
 {
 public:
+    void handle(ecs& ctx, const add_component<transformable>& e);
     void handle(ecs& ctx, const remove_component<transformable>& e);
+
+private:
+    std::unordered_map<const transformable*, entity> entities;
+    std::vector<entity> orphans;
+    bool removing_orphans = false;
 };
 
 #endif
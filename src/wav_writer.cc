@@ -0,0 +1,106 @@
+#include "wav_writer.hh"
+
+// The file is a RIFF header, a "fmt " chunk and a "data" chunk with the
+// samples. All integers are little-endian.
+namespace
+{
+
+constexpr uint32_t HEADER_SIZE = 44;
+
+void put_u16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+void put_u32(uint8_t* dst, uint32_t value)
+{
+    for(unsigned i = 0; i < 4; ++i)
+        dst[i] = value >> (i*8);
+}
+
+void put_tag(uint8_t* dst, const char* tag)
+{
+    for(unsigned i = 0; i < 4; ++i)
+        dst[i] = tag[i];
+}
+
+}
+
+wav_writer::wav_writer()
+: channels(0), written_frames(0)
+{
+}
+
+wav_writer::~wav_writer()
+{
+    close();
+}
+
+bool wav_writer::open(
+    const std::string& path, uint32_t samplerate, uint16_t channels
+){
+    close();
+    f.open(path, std::ios::binary | std::ios::trunc);
+    if(!f) return false;
+
+    this->channels = channels;
+    written_frames = 0;
+
+    // The sizes are left at zero until close().
+    uint8_t header[HEADER_SIZE] = {};
+    put_tag(header, "RIFF");
+    put_tag(header+8, "WAVE");
+    put_tag(header+12, "fmt ");
+    put_u32(header+16, 16);
+    put_u16(header+20, 1); // PCM
+    put_u16(header+22, channels);
+    put_u32(header+24, samplerate);
+    put_u32(header+28, samplerate * channels * sizeof(int16_t));
+    put_u16(header+32, channels * sizeof(int16_t));
+    put_u16(header+34, 16);
+    put_tag(header+36, "data");
+    f.write((const char*)header, sizeof(header));
+    return bool(f);
+}
+
+void wav_writer::write(const int16_t* samples, size_t count)
+{
+    if(!f.is_open()) return;
+    size_t values = count * channels;
+    scratch.resize(values * sizeof(int16_t));
+    for(size_t i = 0; i < values; ++i)
+        put_u16(scratch.data() + i*2, samples[i]);
+    f.write((const char*)scratch.data(), scratch.size());
+    written_frames += count;
+}
+
+bool wav_writer::close()
+{
+    if(!f.is_open()) return true;
+
+    // The RIFF size counts everything after itself.
+    uint64_t data_size = written_frames * channels * sizeof(int16_t);
+    bool fits = data_size <= UINT32_MAX - (HEADER_SIZE - 8);
+    uint8_t size[4];
+    put_u32(size, HEADER_SIZE - 8 + data_size);
+    f.seekp(4);
+    f.write((const char*)size, sizeof(size));
+    put_u32(size, data_size);
+    f.seekp(40);
+    f.write((const char*)size, sizeof(size));
+    // Write errors stick, so this covers all of the samples too.
+    bool ok = bool(f);
+    f.close();
+    return ok && bool(f) && fits;
+}
+
+bool wav_writer::is_open() const
+{
+    return f.is_open();
+}
+
+uint64_t wav_writer::get_written_frames() const
+{
+    return written_frames;
+}
@@ -0,0 +1,36 @@
+#ifndef RAYBOY_WAV_WRITER_HH
+#define RAYBOY_WAV_WRITER_HH
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+// Streams 16-bit PCM audio into a WAV file. The sizes in the header are only
+// known at the end, so they are filled in when the file is closed.
+class wav_writer
+{
+public:
+    wav_writer();
+    wav_writer(const wav_writer& other) = delete;
+    // Closes the file if it's still open.
+    ~wav_writer();
+
+    bool open(const std::string& path, uint32_t samplerate, uint16_t channels);
+    // Takes interleaved samples, count is in frames of all channels.
+    void write(const int16_t* samples, size_t count);
+    // Returns false if any of the data couldn't be written, or if there is
+    // more of it than a WAV file can hold.
+    bool close();
+    bool is_open() const;
+
+    uint64_t get_written_frames() const;
+
+private:
+    std::ofstream f;
+    uint16_t channels;
+    uint64_t written_frames;
+    // Samples are converted into little-endian bytes here first.
+    std::vector<uint8_t> scratch;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# Generates a pair of test ROMs that exchange bytes over the link cable the
+# way games do, and runs them with rayboy-bench --link-check.
+#
+# The side with the external clock loads its next byte into SB and waits; the
+# clocking side waits a moment for it to be ready and then starts the
+# transfer. Both sides check every byte they receive, count the correct and
+# incorrect ones at $C000 and $C001, and set $C002 after the last exchange.
+# A cable that lets the clocking side read a stale SB from the other side
+# shows up as incorrect bytes on the clocking side.
+#
+# Usage: link_handshake.py path/to/rayboy-bench [output_dir]
+import os
+import subprocess
+import sys
+import tempfile
+
+EXCHANGES = 200
+# The external clock side sends the index plus this, the clocking side just
+# the index.
+EXTERNAL_OFFSET = 0x40
+FRAMES = 600
+
+NINTENDO_LOGO = bytes([
+    0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B, 0x03, 0x73, 0x00, 0x83,
+    0x00, 0x0C, 0x00, 0x0D, 0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
+    0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99, 0xBB, 0xBB, 0x67, 0x63,
+    0x6E, 0x0E, 0xEC, 0xCC, 0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E,
+])
+
+
+class assembler:
+    def __init__(self, origin):
+        self.origin = origin
+        self.code = bytearray()
+        self.labels = {}
+        self.fixups = []
+
+    def emit(self, *data):
+        self.code += bytes(data)
+
+    def label(self, name):
+        self.labels[name] = self.origin + len(self.code)
+
+    def jr(self, opcode, name):
+        self.emit(opcode, 0)
+        self.fixups.append((len(self.code) - 1, name))
+
+    def link(self):
+        for offset, name in self.fixups:
+            rel = self.labels[name] - (self.origin + offset + 1)
+            assert -128 <= rel <= 127
+            self.code[offset] = rel & 0xFF
+        return bytes(self.code)
+
+
+JR = 0x18
+JR_Z = 0x28
+JR_NZ = 0x20
+
+
+def program(clocking):
+    a = assembler(0x150)
+    a.emit(0xF3)                    # di
+    a.emit(0x31, 0xFF, 0xDF)        # ld sp, $DFFF
+    a.emit(0xAF)                    # xor a
+    for addr in (0xC000, 0xC001, 0xC002):
+        a.emit(0xEA, addr & 0xFF, addr >> 8)    # ld [addr], a
+    a.emit(0x06, 0x00)              # ld b, 0
+
+    if clocking:
+        # Give the other side plenty of time to get through the boot ROM.
+        a.emit(0x16, 0x00)          # ld d, 0
+        a.label("boot_delay_outer")
+        a.emit(0x0E, 0x00)          # ld c, 0
+        a.label("boot_delay")
+        a.emit(0x0D)                # dec c
+        a.jr(JR_NZ, "boot_delay")
+        a.emit(0x15)                # dec d
+        a.jr(JR_NZ, "boot_delay_outer")
+
+    a.label("loop")
+    if clocking:
+        # About a millisecond, far longer than the other side needs to load
+        # its next byte.
+        a.emit(0x0E, 0x00)          # ld c, 0
+        a.label("delay")
+        a.emit(0x0D)                # dec c
+        a.jr(JR_NZ, "delay")
+
+    a.emit(0x78)                    # ld a, b
+    if not clocking:
+        a.emit(0xC6, EXTERNAL_OFFSET)   # add a, EXTERNAL_OFFSET
+    a.emit(0xE0, 0x01)              # ldh [SB], a
+    a.emit(0x3E, 0x81 if clocking else 0x80)    # ld a, start | clock
+    a.emit(0xE0, 0x02)              # ldh [SC], a
+
+    a.label("wait")
+    a.emit(0xF0, 0x02)              # ldh a, [SC]
+    a.emit(0xCB, 0x7F)              # bit 7, a
+    a.jr(JR_NZ, "wait")
+
+    a.emit(0xF0, 0x01)              # ldh a, [SB]
+    a.emit(0x4F)                    # ld c, a
+    a.emit(0x78)                    # ld a, b
+    if clocking:
+        a.emit(0xC6, EXTERNAL_OFFSET)   # add a, EXTERNAL_OFFSET
+    a.emit(0xB9)                    # cp c
+    a.emit(0x21, 0x00, 0xC0)        # ld hl, $C000
+    a.jr(JR_Z, "count")
+    a.emit(0x23)                    # inc hl
+    a.label("count")
+    a.emit(0x34)                    # inc [hl]
+
+    a.emit(0x04)                    # inc b
+    a.emit(0x78)                    # ld a, b
+    a.emit(0xFE, EXCHANGES)         # cp EXCHANGES
+    a.jr(JR_NZ, "loop")
+
+    a.emit(0x3E, 0x01)              # ld a, 1
+    a.emit(0xEA, 0x02, 0xC0)        # ld [$C002], a
+    a.label("done")
+    a.jr(JR, "done")
+    return a.link()
+
+
+def rom(clocking):
+    data = bytearray(0x8000)
+    data[0x100:0x104] = bytes([0x00, 0xC3, 0x50, 0x01])    # nop; jp $0150
+    data[0x104:0x134] = NINTENDO_LOGO
+    # Same title on both sides, so that the boot ROM takes equally long.
+    title = b"LINKTEST"
+    data[0x134:0x134 + len(title)] = title
+    data[0x143] = 0x80  # Color Game Boy features
+    # ROM only, 32 KiB, no RAM.
+    data[0x147:0x14A] = bytes([0x00, 0x00, 0x00])
+    checksum = 0
+    for byte in data[0x134:0x14D]:
+        checksum = (checksum - byte - 1) & 0xFF
+    data[0x14D] = checksum
+
+    code = program(clocking)
+    data[0x150:0x150 + len(code)] = code
+    return bytes(data)
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print("Usage: {} path/to/rayboy-bench [output_dir]".format(sys.argv[0]))
+        return 1
+
+    with tempfile.TemporaryDirectory() as tmp:
+        out = sys.argv[2] if len(sys.argv) == 3 else tmp
+        paths = []
+        for name, clocking in (("clocking", True), ("external", False)):
+            path = os.path.join(out, "link_{}.gbc".format(name))
+            with open(path, "wb") as f:
+                f.write(rom(clocking))
+            paths.append(path)
+
+        return subprocess.call([
+            sys.argv[1], paths[0], "--link-check", paths[1], str(FRAMES)
+        ])
+
+
+if __name__ == "__main__":
+    sys.exit(main())
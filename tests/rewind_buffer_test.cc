@@ -0,0 +1,88 @@
+#include "rewind_buffer.hh"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Pushes states through a small rewind buffer for many laps of its storage,
+// with deltas of widely varying size, and checks that stepping back restores
+// every state still in the history exactly. Partial rewinds in between make
+// the ring continue from the middle too.
+namespace
+{
+
+constexpr size_t STATE_SIZE = 1024;
+constexpr size_t BUDGET = 8*1024;
+constexpr unsigned ROUNDS = 200;
+
+std::vector<uint8_t> capture(rewind_buffer& buf, const std::vector<uint8_t>& state)
+{
+    uint8_t* dst;
+    while(!(dst = buf.begin_capture()))
+        std::this_thread::yield();
+    memcpy(dst, state.data(), state.size());
+    buf.end_capture();
+    return state;
+}
+
+bool check_rewind(
+    rewind_buffer& buf,
+    std::vector<std::vector<uint8_t>>& history,
+    size_t steps
+){
+    std::vector<uint8_t> state(STATE_SIZE);
+    for(size_t i = 0; i < steps; ++i)
+    {
+        if(!buf.step_back(state.data()))
+            return true;
+        if(history.empty() || state != history.back())
+        {
+            fprintf(stderr, "Wrong state %zu steps back\n", i);
+            return false;
+        }
+        history.pop_back();
+    }
+    return true;
+}
+
+}
+
+int main()
+{
+    std::mt19937 rng(1234);
+    rewind_buffer buf(BUDGET);
+    buf.reset(STATE_SIZE);
+
+    std::vector<std::vector<uint8_t>> history;
+    std::vector<uint8_t> state(STATE_SIZE, 0);
+    size_t pushed = 0;
+    for(unsigned round = 0; round < ROUNDS; ++round)
+    {
+        unsigned count = 1 + rng() % 40;
+        for(unsigned i = 0; i < count; ++i)
+        {
+            // Anything from a couple of bytes to most of the state changes.
+            unsigned changes = 1 << (rng() % 10);
+            for(unsigned j = 0; j < changes; ++j)
+                state[rng() % STATE_SIZE] = rng();
+            history.push_back(capture(buf, state));
+            pushed++;
+        }
+
+        if(!check_rewind(buf, history, rng() % 8))
+            return 1;
+        if(history.size() != 0)
+            state = history.back();
+    }
+
+    size_t remaining = history.size();
+    if(!check_rewind(buf, history, SIZE_MAX))
+        return 1;
+
+    printf(
+        "Pushed %zu states, %zu were left in the history\n",
+        pushed, remaining - history.size()
+    );
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "save_writer.hh"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+namespace fs = std::filesystem;
+
+// Writes a save into a directory that doesn't exist, which must be reported
+// as failed so that the caller knows to try again, and then retries into one
+// that does. A burst of writes to the same file must leave the newest data on
+// disk, and waiting on any of them must report it as written.
+namespace
+{
+
+bool write(save_writer& w, const std::string& path, uint8_t value, uint64_t& generation)
+{
+    uint8_t* data = w.begin_write(64);
+    memset(data, value, 64);
+    generation = w.end_write(path);
+    return w.wait(generation);
+}
+
+bool check_file(const fs::path& path, uint8_t value)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::vector<uint8_t> data(
+        (std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>()
+    );
+    return data == std::vector<uint8_t>(64, value);
+}
+
+}
+
+int main()
+{
+    fs::path dir = fs::temp_directory_path()/"rayboy_save_writer_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path missing = dir/"missing"/"game.sav";
+    fs::path path = dir/"game.sav";
+
+    int result = 0;
+    {
+        save_writer w;
+        uint64_t generation = 0;
+        if(write(w, missing.string(), 1, generation))
+        {
+            fprintf(stderr, "Write into a missing directory didn't fail\n");
+            result = 1;
+        }
+        if(w.get_failed_generation() != generation)
+        {
+            fprintf(stderr, "Failed write wasn't recorded\n");
+            result = 1;
+        }
+
+        uint64_t failed = generation;
+        if(!write(w, path.string(), 2, generation) || !check_file(path, 2))
+        {
+            fprintf(stderr, "Retried write didn't succeed\n");
+            result = 1;
+        }
+        if(w.get_failed_generation() != failed)
+        {
+            fprintf(stderr, "Successful write was recorded as failed\n");
+            result = 1;
+        }
+
+        uint64_t first = 0;
+        for(unsigned i = 0; i < 100; ++i)
+        {
+            memset(w.begin_write(64), 3 + i, 64);
+            generation = w.end_write(path.string());
+            if(i == 0) first = generation;
+        }
+        if(!w.wait(first) || !w.wait(generation) || !check_file(path, 102))
+        {
+            fprintf(stderr, "Burst of writes didn't leave the newest data\n");
+            result = 1;
+        }
+    }
+
+    fs::remove_all(dir);
+    return result;
+}